@@ -48,6 +48,10 @@ void app_main(void) {
         app->led_->On(StatusLed::kGreen);
     }
 
+    MQTT::TopicHandle ping = app->RegisterTopic("ping");
+    // The payload never changes: only send it once a minute
+    app->GetMQTT()->SetPublishPolicy(app->GetMQTT()->Prefixed("ping").c_str(),
+                                     {.on_change = true, .heartbeat = 11});
     if (app->InitMQTT() == ESP_OK) {
         app->AddSubscription("test/#");
         app->StartMQTT();
@@ -58,6 +62,6 @@ void app_main(void) {
     while (true) {
         ESP_LOGI(kTag, "App running ...");
         vTaskDelay(pdMS_TO_TICKS(5000));
-        app->PublishMessage((app->TopicBase() + "ping").c_str(), "Hello MQTT");
+        app->PublishMessage(ping, "Hello MQTT");
     }
 }
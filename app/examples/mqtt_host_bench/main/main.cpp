@@ -0,0 +1,411 @@
+/**
+ ******************************************************************************
+ * @file        : main.cpp
+ * @brief       : MQTT host benchmark
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Runs the MQTT class on the ESP-IDF linux target against a
+ *                local broker. Every run publishes with PublishAsync on a topic
+ *                the client subscribes to, keeping at most `window` messages
+ *                in flight, and reports the throughput, the publish-to-ack
+ *                latency (QoS 1 and 2) and the publish-to-delivery latency.
+ *                Request runs measure the round trip of MQTT::Request against
+ *                a responder on the same client. Handlers run on an inbound
+ *                worker, as with App. The final checks fail the run if a
+ *                blocked handler holds up the MQTT task, or if MQTT does not
+ *                connect again after the broker dropped the connection.
+ ******************************************************************************
+ */
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <mqtt_client.h>
+#include <nvs.h>
+#include <nvs_flash.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "mqtt.hpp"
+
+extern "C" {
+void app_main(void);
+}
+
+static const char* kTag = "mqtt bench";
+
+static const char* kDefaultBroker = "mqtt://127.0.0.1:1883";
+static const int kDefaultMessages = 2000;
+static const int kConnectTimeoutMs = 10000;
+static const int kRunTimeoutMs = 60000;
+static const int kReconnectTimeoutMs = 5000;
+static const int kAckTimeoutMs = 2000;
+
+static const int kPayloadSizes[] = {16, 256, 4096};
+static const int kQosLevels[] = {0, 1, 2};
+static const int kWindows[] = {1, 8, 32};
+
+// State of the current run, shared with the MQTT task
+static struct {
+    SemaphoreHandle_t window;
+    std::vector<int64_t> sent;  // esp_timer_get_time() by sequence number
+    std::vector<int64_t> ack_latency;
+    std::vector<int64_t> delivery_latency;
+    std::atomic<int> acked;
+    std::atomic<int> delivered;
+    std::atomic<int> failed;
+    int qos;
+} run;
+
+static const char* Broker() {
+    const char* broker = getenv("MQTT_BROKER");
+    return broker != nullptr ? broker : kDefaultBroker;
+}
+
+static std::string ClientId() {
+    return "bench-" + std::to_string(getpid());
+}
+
+static esp_err_t ConfigureBroker() {
+    std::string topic_base = "bench/" + std::to_string(getpid()) + "/";
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("mqtt", NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_str(handle, "broker", Broker());
+    if (err == ESP_OK) {
+        err = nvs_set_str(handle, "topic-base", topic_base.c_str());
+    }
+    if (err == ESP_OK) {
+        err = nvs_set_str(handle, "client-id", ClientId().c_str());
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+static int64_t Percentile(std::vector<int64_t>* values, double p) {
+    if (values->empty()) {
+        return -1;
+    }
+    size_t n = std::min(values->size() - 1, (size_t)(p * values->size()));
+    std::nth_element(values->begin(), values->begin() + n, values->end());
+    return (*values)[n];
+}
+
+static void OnDelivery(std::string_view topic, std::string_view payload) {
+    uint32_t seq;
+    if (payload.size() < sizeof(seq)) {
+        return;
+    }
+    memcpy(&seq, payload.data(), sizeof(seq));
+    if (seq >= run.sent.size()) {
+        return;
+    }
+    run.delivery_latency[seq] = esp_timer_get_time() - run.sent[seq];
+    run.delivered++;
+    if (run.qos == 0) {
+        xSemaphoreGive(run.window);
+    }
+}
+
+// Echoes "<response topic>\n<data>" requests on the response topic
+static void OnRequest(std::string_view topic, std::string_view payload) {
+    size_t eol = payload.find('\n');
+    if (eol == std::string_view::npos) {
+        return;
+    }
+    std::string response_topic(payload.substr(0, eol));
+    std::string_view data = payload.substr(eol + 1);
+    MQTT::GetInstance()->PublishAsync(response_topic.c_str(), data.data(), data.size(), 1);
+}
+
+// State of the current request run; callbacks may still run after a timed out run
+static struct {
+    SemaphoreHandle_t slots;
+    SemaphoreHandle_t mutex;
+    std::vector<int64_t> round_trip;
+    int failed;
+} requests_run;
+
+static void RunRequests(MQTT* mqtt, int requests, int window) {
+    if (requests_run.mutex == nullptr) {
+        requests_run.mutex = xSemaphoreCreateMutex();
+    }
+    requests_run.slots = xSemaphoreCreateCounting(window, window);
+    requests_run.round_trip.clear();
+    requests_run.failed = 0;
+    std::string request_topic = mqtt->Prefixed("service");
+
+    int64_t start = esp_timer_get_time();
+    int64_t deadline = start + kRunTimeoutMs * 1000LL;
+    for (int i = 0; i < requests; i++) {
+        int64_t wait_us = std::max<int64_t>(deadline - esp_timer_get_time(), 0);
+        if (xSemaphoreTake(requests_run.slots, pdMS_TO_TICKS(wait_us / 1000)) != pdTRUE) {
+            break;
+        }
+        int64_t sent = esp_timer_get_time();
+        SemaphoreHandle_t slots = requests_run.slots;
+        esp_err_t err = mqtt->Request(
+            request_topic.c_str(),
+            [](const std::string& response_topic) { return response_topic + "\nping"; },
+            [sent, slots](esp_err_t result, std::string_view payload) {
+                xSemaphoreTake(requests_run.mutex, portMAX_DELAY);
+                if (result == ESP_OK) {
+                    requests_run.round_trip.push_back(esp_timer_get_time() - sent);
+                } else {
+                    requests_run.failed++;
+                }
+                xSemaphoreGive(requests_run.mutex);
+                xSemaphoreGive(slots);
+            });
+        if (err != ESP_OK) {
+            xSemaphoreTake(requests_run.mutex, portMAX_DELAY);
+            requests_run.failed++;
+            xSemaphoreGive(requests_run.mutex);
+            xSemaphoreGive(requests_run.slots);
+        }
+    }
+    // Every request completes, at the latest when it times out
+    while (mqtt->PendingRequests() > 0) {
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    double seconds = (esp_timer_get_time() - start) / 1e6;
+
+    xSemaphoreTake(requests_run.mutex, portMAX_DELAY);
+    std::vector<int64_t> round_trip = requests_run.round_trip;
+    int failed = requests_run.failed;
+    xSemaphoreGive(requests_run.mutex);
+    printf("BENCH mqtt request window=%-3d req/s=%.0f rtt-p50=%lld rtt-p90=%lld rtt-p99=%lld "
+           "failed=%d\n",
+           window,
+           round_trip.size() / seconds,
+           (long long)Percentile(&round_trip, 0.5),
+           (long long)Percentile(&round_trip, 0.9),
+           (long long)Percentile(&round_trip, 0.99),
+           failed);
+    // Not deleted: a completing callback may still give it
+    requests_run.slots = nullptr;
+}
+
+static void Run(MQTT* mqtt, MQTT::TopicHandle topic, int messages, int size, int qos, int window) {
+    run.window = xSemaphoreCreateCounting(window, window);
+    run.sent.assign(messages, 0);
+    run.ack_latency.assign(messages, -1);
+    run.delivery_latency.assign(messages, -1);
+    run.acked = 0;
+    run.delivered = 0;
+    run.failed = 0;
+    run.qos = qos;
+
+    std::vector<char> payload(size, 'x');
+    int64_t start = esp_timer_get_time();
+    int64_t deadline = start + kRunTimeoutMs * 1000LL;
+    for (uint32_t seq = 0; seq < (uint32_t)messages; seq++) {
+        int64_t wait_us = std::max<int64_t>(deadline - esp_timer_get_time(), 0);
+        if (xSemaphoreTake(run.window, pdMS_TO_TICKS(wait_us / 1000)) != pdTRUE) {
+            break;
+        }
+        memcpy(payload.data(), &seq, sizeof(seq));
+        run.sent[seq] = esp_timer_get_time();
+        esp_err_t err = mqtt->PublishAsync(
+            topic, payload.data(), size, qos, 0, [seq](esp_err_t result) {
+                if (result == ESP_OK) {
+                    run.ack_latency[seq] = esp_timer_get_time() - run.sent[seq];
+                    run.acked++;
+                } else {
+                    run.failed++;
+                }
+                if (run.qos > 0) {
+                    xSemaphoreGive(run.window);
+                }
+            });
+        if (err != ESP_OK) {
+            run.failed++;
+            xSemaphoreGive(run.window);
+        }
+    }
+    while (run.delivered + run.failed < messages && esp_timer_get_time() < deadline) {
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    double seconds = (esp_timer_get_time() - start) / 1e6;
+
+    std::vector<int64_t> ack, delivery;
+    for (int i = 0; i < messages; i++) {
+        if (run.ack_latency[i] >= 0 && qos > 0) {
+            ack.push_back(run.ack_latency[i]);
+        }
+        if (run.delivery_latency[i] >= 0) {
+            delivery.push_back(run.delivery_latency[i]);
+        }
+    }
+    // One line per run, easy to grep and compare on CI; latencies in microseconds
+    printf(
+        "BENCH mqtt qos=%d payload=%-5d window=%-3d msgs/s=%.0f bytes/s=%.0f "
+        "ack-p50=%lld ack-p90=%lld ack-p99=%lld "
+        "delivery-p50=%lld delivery-p90=%lld delivery-p99=%lld lost=%d\n",
+        qos,
+        size,
+        window,
+        run.delivered / seconds,
+        run.delivered * (double)size / seconds,
+        (long long)Percentile(&ack, 0.5),
+        (long long)Percentile(&ack, 0.9),
+        (long long)Percentile(&ack, 0.99),
+        (long long)Percentile(&delivery, 0.5),
+        (long long)Percentile(&delivery, 0.9),
+        (long long)Percentile(&delivery, 0.99),
+        messages - (int)run.delivered);
+    vSemaphoreDelete(run.window);
+}
+
+static bool WaitFor(std::function<bool()> condition, int timeout_ms) {
+    for (int waited = 0; !condition(); waited += 10) {
+        if (waited >= timeout_ms) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return true;
+}
+
+// Handler blocked until the check releases it
+static struct {
+    SemaphoreHandle_t release;
+    std::atomic<bool> entered;
+    std::atomic<bool> acked;  // the publish sent while blocked
+} blocked;
+
+static void OnBlock(std::string_view topic, std::string_view payload) {
+    blocked.entered = true;
+    xSemaphoreTake(blocked.release, pdMS_TO_TICKS(kRunTimeoutMs));
+}
+
+// While a handler blocks its worker, the MQTT task must keep processing
+// acknowledgements (and keepalives)
+static bool CheckBlockedHandler(MQTT* mqtt) {
+    blocked.release = xSemaphoreCreateBinary();
+    std::string block_topic = mqtt->Prefixed("block");
+    mqtt->PublishAsync(block_topic.c_str(), "x", 1, 1);
+    bool entered = WaitFor([] { return blocked.entered.load(); }, kConnectTimeoutMs);
+
+    std::string topic = mqtt->Prefixed("unsubscribed");
+    mqtt->PublishAsync(
+        topic.c_str(), "x", 1, 1, 0, [](esp_err_t result) { blocked.acked = result == ESP_OK; });
+    bool acked = WaitFor([] { return blocked.acked.load(); }, kAckTimeoutMs);
+    xSemaphoreGive(blocked.release);
+    printf("BENCH mqtt blocked-handler entered=%d acked=%d\n", entered, acked);
+    return entered && acked;
+}
+
+// A second client with the same client id takes the session over: the broker
+// drops the connection of MQTT, which must then connect again on its own.
+static bool CheckReconnect(MQTT* mqtt) {
+    uint32_t connects = mqtt->GetMetrics().connects;
+    std::string client_id = ClientId();
+    esp_mqtt_client_config_t config = {};
+    config.broker.address.uri = Broker();
+    config.credentials.client_id = client_id.c_str();
+    config.network.disable_auto_reconnect = true;
+    esp_mqtt_client_handle_t intruder = esp_mqtt_client_init(&config);
+    if (intruder == nullptr || esp_mqtt_client_start(intruder) != ESP_OK) {
+        ESP_LOGE(kTag, "Failed to start the second client");
+        return false;
+    }
+    bool dropped = WaitFor([mqtt] { return mqtt->GetState() != MQTT::State::kConnected; },
+                           kConnectTimeoutMs);
+    esp_mqtt_client_stop(intruder);
+    esp_mqtt_client_destroy(intruder);
+    if (!dropped) {
+        ESP_LOGE(kTag, "The broker did not drop the connection");
+        return false;
+    }
+
+    int64_t start = esp_timer_get_time();
+    bool reconnected =
+        WaitFor([mqtt, connects] { return mqtt->GetMetrics().connects > connects; },
+                kReconnectTimeoutMs);
+    printf("BENCH mqtt reconnect ok=%d reconnect-ms=%lld\n",
+           reconnected,
+           (long long)(esp_timer_get_time() - start) / 1000);
+    return reconnected;
+}
+
+void app_main(void) {
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ESP_ERROR_CHECK(nvs_flash_init());
+    }
+    ESP_ERROR_CHECK(ConfigureBroker());
+
+    const char* count = getenv("MQTT_BENCH_MESSAGES");
+    int messages = count != nullptr ? atoi(count) : kDefaultMessages;
+
+    MQTT* mqtt = MQTT::GetInstance();
+    MQTT::TopicHandle topic = mqtt->RegisterTopic("echo");
+    mqtt->AddSubscription("echo", 2, OnDelivery, true);
+    mqtt->AddSubscription("service", 1, OnRequest, true);
+    mqtt->AddSubscription("block", 1, OnBlock, true);
+    mqtt->SetInboundWorkers(1, 256, 256 * 1024);
+    mqtt->EnableRequests("response/", 64);
+    mqtt->SetReassembly(1, 8 * 1024);
+    mqtt->SetBackoff(100, 1000);
+    mqtt->SetResumeJitter(0);  // subscribe as soon as connected
+    ESP_ERROR_CHECK(mqtt->Init());
+    ESP_ERROR_CHECK(mqtt->Start());
+    for (int waited = 0; !mqtt->IsConnected(); waited += 100) {
+        if (waited >= kConnectTimeoutMs) {
+            ESP_LOGE(kTag, "Broker not reachable");
+            exit(EXIT_FAILURE);
+        }
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    vTaskDelay(pdMS_TO_TICKS(500));  // let the subscription complete
+
+    for (int qos : kQosLevels) {
+        for (int size : kPayloadSizes) {
+            for (int window : kWindows) {
+                Run(mqtt, topic, messages, size, qos, window);
+            }
+        }
+    }
+
+    for (int window : kWindows) {
+        RunRequests(mqtt, messages, window);
+    }
+
+    MQTT::PublishMetrics metrics = mqtt->GetPublishMetrics();
+    printf("BENCH mqtt totals published=%u acked=%u retransmits-estimated=%u expired=%u "
+           "timed-out=%u bytes-out=%llu bytes-in=%llu ack-max-ms=%u\n",
+           (unsigned)metrics.published,
+           (unsigned)metrics.acked,
+           (unsigned)metrics.retransmits_estimated,
+           (unsigned)metrics.expired,
+           (unsigned)metrics.timed_out,
+           (unsigned long long)metrics.bytes_out,
+           (unsigned long long)metrics.bytes_in,
+           (unsigned)metrics.ack_latency_max_ms);
+
+    bool ok = CheckBlockedHandler(mqtt);
+    ok = CheckReconnect(mqtt) && ok;
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,270 @@
+/**
+ ******************************************************************************
+ * @file        : main.cpp
+ * @brief       : MQTT host test
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Exercises the parts of the MQTT layer that do not need a
+ *                broker on the ESP-IDF linux target, then measures the
+ *                dispatch and telemetry encoding rates. The client is never
+ *                started: publishes and requests go to the offline queue.
+ ******************************************************************************
+ */
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <nvs.h>
+#include <nvs_flash.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mqtt.hpp"
+#include "reassembler.hpp"
+#include "telemetry_batch.hpp"
+#include "topic_trie.hpp"
+
+extern "C" {
+void app_main(void);
+}
+
+static const char* kTag = "mqtt test";
+
+static const int kIterations = 1000;
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what) {
+    if (!condition) {
+        ESP_LOGE(kTag, "FAILED: %s", what);
+        failures++;
+    }
+}
+
+static void TestTopicTrie() {
+    TopicTrie trie;
+    std::map<std::string, int> calls;
+    const char* filters[] = {"a/b/c", "a/+/c", "a/#", "#", "+/b", "a/b/+/d", "$SYS/#"};
+    for (auto filter : filters) {
+        std::string f = filter;
+        trie.Add(filter, [&calls, f](std::string_view, std::string_view) { calls[f]++; });
+    }
+
+    Check(trie.Dispatch("a/b/c", "") == 4, "a/b/c matches a/b/c, a/+/c, a/# and #");
+    Check(calls["a/b/c"] == 1 && calls["a/+/c"] == 1 && calls["+/b"] == 0, "Matched handlers");
+    Check(trie.Dispatch("a", "") == 2, "a matches a/# and #");
+    Check(trie.Dispatch("x/b", "") == 2, "x/b matches +/b and #");
+    Check(trie.Dispatch("a/b/x/d", "") == 3, "a/b/x/d matches a/b/+/d, a/# and #");
+    Check(trie.Dispatch("$SYS/load", "") == 1, "Wildcards do not match $ topics");
+
+    // A single filter follows the same rules
+    for (auto topic : {"a/b/c", "a", "x/b", "a/b/x/d", "$SYS/load", "a/b", "a/b/c/d"}) {
+        int matches = 0;
+        for (auto filter : filters) {
+            matches += TopicTrie::Matches(filter, topic);
+        }
+        Check(matches == trie.Dispatch(topic, ""), "Matches agrees with Dispatch");
+    }
+
+    std::string payload;
+    TopicTrie views;
+    views.Add("t", [&payload](std::string_view, std::string_view p) { payload = p; });
+    views.Dispatch(std::string_view("t/extra", 1), std::string_view("data!", 4));
+    Check(payload == "data", "Topic and payload views honor their length");
+
+    std::string seen;
+    TopicTrie prefixed;
+    prefixed.Add("cmd/+", [&seen](std::string_view topic, std::string_view) { seen = topic; });
+    Check(prefixed.Dispatch("dev/1/cmd/x", "", 6) == 1 && seen == "dev/1/cmd/x",
+          "Filters below a prefix get the whole topic");
+}
+
+static void TestReassembler() {
+    Reassembler reassembler;
+    Check(reassembler.Configure(1, 8) == ESP_OK, "Configure reassembler");
+    std::shared_ptr<char> message;
+    Check(!reassembler.Add("t/a", "0123", 4, 0, 10, &message) && reassembler.Oversized() == 1,
+          "Message larger than the buffers dropped");
+    Check(reassembler.Configure(1, 64) == ESP_ERR_INVALID_STATE,
+          "Reassembler cannot grow once allocated");
+    Check(!reassembler.Add("", "4567", 4, 4, 10, &message) && message == nullptr,
+          "Rest of an oversized message ignored");
+
+    Check(!reassembler.Add("t/b", "0123", 4, 0, 6, &message), "First fragment");
+    Check(!reassembler.Add("", "45", 2, 5, 6, &message), "Fragment out of order dropped");
+    Check(!reassembler.Add("", "5", 1, 5, 6, &message) && message == nullptr,
+          "Rest of a dropped message ignored");
+
+    Check(!reassembler.Add("t/c", "0123", 4, 0, 6, &message), "First fragment");
+    Check(reassembler.Add("", "45", 2, 4, 6, &message) && message != nullptr &&
+              memcmp(message.get(), "012345", 6) == 0 && reassembler.Topic() == "t/c",
+          "Message reassembled");
+    Check(!reassembler.Add("t/d", "0123", 4, 0, 6, &message), "No buffer while one is held");
+    message = nullptr;
+    Check(!reassembler.Add("t/e", "0123", 4, 0, 6, &message) &&
+              reassembler.Add("", "45", 2, 4, 6, &message),
+          "Buffer back in the pool once released");
+}
+
+static void TestTelemetryBatch() {
+    TelemetryBatch batch;
+    batch.Add(0, 1000, 215);
+    batch.Add(1, 1000, -3);
+    batch.Add(0, 1100, 217);
+    const std::vector<uint8_t> expected = {
+        'T', 1, 0xe8, 0x07, 0, 0, 0xae, 0x03, 1, 0, 0x05, 0, 0xc8, 0x01, 0x04};
+    Check(batch.Data() == expected, "Telemetry batch encoding");
+    Check(batch.Samples() == 3, "Telemetry batch samples");
+
+    batch.Reset();
+    batch.Add(0, 2000, 5);
+    Check(batch.Data().size() == 7 && batch.Data()[6] == 10, "Reset restarts the deltas");
+}
+
+static void Bench(const char* name, int iterations, std::function<esp_err_t(int)> operation) {
+    int errors = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        if (operation(i) != ESP_OK) {
+            errors++;
+        }
+    }
+    auto stop = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(stop - start).count();
+
+    Check(errors == 0, name);
+    // One line per benchmark, easy to grep and compare on CI
+    printf("BENCH %-24s ops=%d ops/s=%.0f errors=%d\n",
+           name,
+           iterations,
+           iterations / seconds,
+           errors);
+}
+
+static void RunBenchmarks() {
+    TopicTrie trie;
+    int matched = 0;
+    for (int i = 0; i < 100; i++) {
+        trie.Add("site/+/device" + std::to_string(i) + "/#",
+                 [&matched](std::string_view, std::string_view) { matched++; });
+    }
+    TelemetryBatch batch;
+    Bench("telemetry-add(3 channels)", kIterations * 100, [&](int i) {
+        if (batch.Size() > 1024) {
+            batch.Reset();
+        }
+        batch.Add(i % 3, 1000 + i * 20, 200 + i % 7);
+        return ESP_OK;
+    });
+
+    Bench("topic-dispatch(100 filters)", kIterations * 100, [&](int i) {
+        return trie.Dispatch("site/hall/device42/sensor/temp", "21.5") == 1 ? ESP_OK : ESP_FAIL;
+    });
+}
+
+// Unreachable: the client is only initialized, never started
+static esp_err_t ConfigureBroker() {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("mqtt", NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_str(handle, "broker", "mqtt://127.0.0.1:1");
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+// Requests time out at their deadline, not on a periodic tick
+static void TestRequestTimeout(MQTT* mqtt) {
+    static SemaphoreHandle_t done = xSemaphoreCreateBinary();
+    static std::atomic<esp_err_t> result;
+    for (int i = 0; i < 3; i++) {
+        int64_t start = esp_timer_get_time();
+        result = ESP_OK;
+        Check(mqtt->Request(
+                  "service",
+                  "ping",
+                  0,
+                  [](esp_err_t err, std::string_view) {
+                      result = err;
+                      xSemaphoreGive(done);
+                  },
+                  100) == ESP_OK,
+              "Request queued");
+        Check(xSemaphoreTake(done, pdMS_TO_TICKS(1000)) == pdTRUE, "Request completed");
+        int64_t elapsed_ms = (esp_timer_get_time() - start) / 1000;
+        Check(result == ESP_ERR_TIMEOUT, "Request timed out");
+        Check(elapsed_ms >= 100 && elapsed_ms < 300, "Request timed out at its deadline");
+    }
+    Check(mqtt->PendingRequests() == 0, "No request pending");
+}
+
+static void TestPublishPolicies(MQTT* mqtt) {
+    mqtt->SetPublishPolicy("slow/#", {.on_change = true, .min_interval_ms = 200});
+    size_t queued = mqtt->QueuedMessages();
+    uint32_t suppressed = mqtt->SuppressedMessages();
+    Check(mqtt->Publish("slow/a", "1", 0) == ESP_OK, "First value queued");
+    Check(mqtt->Publish("slow/a", "22", 0) == ESP_OK, "Early value held");
+    Check(mqtt->Publish("slow/a", "333", 0) == ESP_OK, "Newer early value held");
+    Check(mqtt->QueuedMessages() == queued + 1, "Early values not queued yet");
+    Check(mqtt->SuppressedMessages() == suppressed + 1, "Replaced value suppressed");
+    vTaskDelay(pdMS_TO_TICKS(300));
+    Check(mqtt->QueuedMessages() == queued + 2, "Latest value sent after the interval");
+    Check(mqtt->Publish("slow/a", "333", 0) == ESP_OK, "Same value accepted");
+    Check(mqtt->QueuedMessages() == queued + 2, "Same value suppressed after the trailing send");
+
+    // A rejected message does not count as published: the next identical one is
+    // tried again rather than suppressed
+    mqtt->SetPublishPolicy("full/#", {.on_change = true});
+    mqtt->SetDropPolicy("full/#", MQTT::DropPolicy::kDropNewest);
+    mqtt->SetQueueLimits(mqtt->QueuedMessages(), 64 * 1024);
+    suppressed = mqtt->SuppressedMessages();
+    Check(mqtt->Publish("full/a", "1", 0) == ESP_FAIL, "Full queue rejects");
+    Check(mqtt->Publish("full/a", "1", 0) == ESP_FAIL, "Rejected value not suppressed");
+    Check(mqtt->SuppressedMessages() == suppressed, "Nothing suppressed");
+}
+
+void app_main(void) {
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ESP_ERROR_CHECK(nvs_flash_init());
+    }
+    ESP_ERROR_CHECK(ConfigureBroker());
+    MQTT* mqtt = MQTT::GetInstance();
+    mqtt->EnableRequests();
+    ESP_ERROR_CHECK(mqtt->Init());
+
+    TestTopicTrie();
+    TestReassembler();
+    TestTelemetryBatch();
+    TestRequestTimeout(mqtt);
+    TestPublishPolicies(mqtt);
+    RunBenchmarks();
+
+    if (failures > 0) {
+        ESP_LOGE(kTag, "%d check(s) failed", failures);
+        exit(EXIT_FAILURE);
+    }
+    ESP_LOGI(kTag, "All checks passed");
+    exit(EXIT_SUCCESS);
+}
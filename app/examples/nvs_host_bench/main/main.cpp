@@ -0,0 +1,802 @@
+/**
+ ******************************************************************************
+ * @file        : main.cpp
+ * @brief       : NVS host test and benchmark
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Exercises NvsHandle and the configuration services against
+ *                the emulated flash of the ESP-IDF linux target, then measures
+ *                operations per second and flash bytes written per operation.
+ ******************************************************************************
+ */
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <nvs_flash.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cJSON.h"
+#include "config_bundle.hpp"
+#include "config_hash.hpp"
+#include "config_profiles.hpp"
+#include "config_sync.hpp"
+#include "nvs_config.hpp"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_ESP_PARTITION_ENABLE_STATS
+#include "esp_private/partition_linux.h"
+#endif
+
+extern "C" {
+void app_main(void);
+}
+
+static const char* kTag = "nvs bench";
+
+static const int kIterations = 1000;
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what) {
+    if (!condition) {
+        ESP_LOGE(kTag, "FAILED: %s", what);
+        failures++;
+    }
+}
+
+static void ResetPartition() {
+    ESP_ERROR_CHECK(nvs_flash_erase());
+    ESP_ERROR_CHECK(nvs_flash_init());
+    ESP_ERROR_CHECK(nvs_flash_erase_partition(NvsHandle::kAppPartition));
+    ESP_ERROR_CHECK(NvsHandle::InitPartition(NvsHandle::kAppPartition));
+    ConfigHash::Invalidate();
+}
+
+static int CountEntries(const char* partition, const char* name_space) {
+    int count = 0;
+    nvs_iterator_t it = nullptr;
+    esp_err_t res = nvs_entry_find(partition, name_space, NVS_TYPE_ANY, &it);
+    while (res == ESP_OK) {
+        count++;
+        res = nvs_entry_next(&it);
+    }
+    nvs_release_iterator(it);
+    return count;
+}
+
+static std::shared_ptr<cJSON> Node(const char* type, const char* value) {
+    std::shared_ptr<cJSON> node(cJSON_CreateObject(), cJSON_Delete);
+    cJSON_AddStringToObject(node.get(), "type", type);
+    cJSON_AddStringToObject(node.get(), "value", value);
+    return node;
+}
+
+static std::shared_ptr<cJSON> Node(const char* type, double value) {
+    std::shared_ptr<cJSON> node(cJSON_CreateObject(), cJSON_Delete);
+    cJSON_AddStringToObject(node.get(), "type", type);
+    cJSON_AddNumberToObject(node.get(), "value", value);
+    return node;
+}
+
+// Recompute the CRC after editing a bundle
+static void Reseal(std::vector<uint8_t>& bundle) {
+    ConfigBundle::Header header;
+    memcpy(&header, bundle.data(), sizeof(header));
+    header.crc = esp_rom_crc32_le(0, bundle.data() + sizeof(header), header.size - sizeof(header));
+    memcpy(bundle.data(), &header, sizeof(header));
+}
+
+// Serialize a small bundle, as tools/mkconfigbundle.py does
+static std::vector<uint8_t> BuildBundle() {
+    static const uint16_t port = 8883;
+    struct {
+        const char* name_space;
+        const char* key;
+        nvs_type_t type;
+        const void* value;
+        uint16_t length;
+    } items[] = {
+        // sorted by namespace, then key
+        {"mqtt", "broker", NVS_TYPE_STR, "mqtt://bundle", 14},
+        {"mqtt", "port", NVS_TYPE_U16, &port, sizeof(port)},
+        {"system", "hostname", NVS_TYPE_STR, "fleet", 6},
+    };
+    const size_t count = sizeof(items) / sizeof(items[0]);
+
+    std::vector<uint8_t> bundle(sizeof(ConfigBundle::Header) +
+                                count * sizeof(ConfigBundle::Entry));
+    auto append = [&](const void* data, size_t length) {
+        uint32_t offset = bundle.size();
+        bundle.insert(bundle.end(), (const uint8_t*)data, (const uint8_t*)data + length);
+        return offset;
+    };
+    for (size_t i = 0; i < count; i++) {
+        ConfigBundle::Entry entry = {};
+        entry.name_space = append(items[i].name_space, strlen(items[i].name_space) + 1);
+        entry.key = append(items[i].key, strlen(items[i].key) + 1);
+        entry.value = append(items[i].value, items[i].length);
+        entry.length = items[i].length;
+        entry.type = items[i].type;
+        memcpy(&bundle[sizeof(ConfigBundle::Header) + i * sizeof(entry)], &entry, sizeof(entry));
+    }
+
+    ConfigBundle::Header header = {};
+    header.magic = ConfigBundle::kMagic;
+    header.version = ConfigBundle::kVersion;
+    header.count = count;
+    header.size = bundle.size();
+    memcpy(bundle.data(), &header, sizeof(header));
+    Reseal(bundle);
+    return bundle;
+}
+
+// ----- Tests -----
+
+static void TestTypeNames() {
+    const char* names[] = {"uint8",
+                           "int8",
+                           "uint16",
+                           "int16",
+                           "uint32",
+                           "int32",
+                           "uint64",
+                           "int64",
+                           "string",
+                           "blob",
+                           "any"};
+    for (auto name : names) {
+        nvs_type_t type;
+        char back[16];
+        Check(NvsHandle::TypeOf(name, &type) == ESP_OK, "TypeOf known type");
+        Check(NvsHandle::TypeName(type, back, sizeof(back)) == ESP_OK, "TypeName known type");
+        Check(strcmp(name, back) == 0, "TypeOf / TypeName round trip");
+    }
+    nvs_type_t type;
+    Check(NvsHandle::TypeOf("float", &type) == ESP_ERR_NVS_TYPE_MISMATCH, "TypeOf unknown type");
+}
+
+static void TestHandle() {
+    ResetPartition();
+    NvsHandle handle;
+    Check(handle.Open("test", NVS_READWRITE) == ESP_OK, "Open read/write");
+
+    struct {
+        nvs_type_t type;
+        double value;
+    } ints[] = {
+        {NVS_TYPE_U8, 200},
+        {NVS_TYPE_I8, -100},
+        {NVS_TYPE_U16, 60000},
+        {NVS_TYPE_I16, -30000},
+        {NVS_TYPE_U32, 4000000000.0},
+        {NVS_TYPE_I32, -2000000000},
+        {NVS_TYPE_U64, 1ULL << 40},
+        {NVS_TYPE_I64, -(1LL << 40)},
+    };
+    for (auto& i : ints) {
+        char key[16];
+        snprintf(key, sizeof(key), "int-%02x", i.type);
+        double value = 0;
+        nvs_type_t type;
+        Check(handle.SetInt(key, i.type, i.value) == ESP_OK, "SetInt");
+        Check(handle.GetInt(key, i.type, &value) == ESP_OK, "GetInt");
+        Check(value == i.value, "GetInt value");
+        Check(handle.FindKey(key, &type) == ESP_OK && type == i.type, "FindKey type");
+    }
+
+    const char* text = "mqtt://broker.example.com:1883";
+    char buffer[64];
+    size_t length = sizeof(buffer);
+    Check(handle.SetString("str", text) == ESP_OK, "SetString");
+    Check(handle.GetString("str", buffer, &length) == ESP_OK, "GetString");
+    Check(strcmp(buffer, text) == 0 && length == strlen(text) + 1, "GetString value");
+
+    uint8_t blob[100];
+    for (size_t i = 0; i < sizeof(blob); i++) {
+        blob[i] = i * 7;
+    }
+    length = sizeof(buffer);
+    Check(handle.SetBlob("blob", blob, sizeof(blob)) == ESP_OK, "SetBlob");
+    Check(handle.GetBlob("blob", buffer, &length) == ESP_ERR_NVS_INVALID_LENGTH,
+          "GetBlob too small buffer");
+    uint8_t blob_back[sizeof(blob)];
+    length = sizeof(blob_back);
+    Check(handle.GetBlob("blob", blob_back, &length) == ESP_OK, "GetBlob");
+    Check(length == sizeof(blob) && memcmp(blob, blob_back, length) == 0, "GetBlob value");
+
+    Check(handle.Commit() == ESP_OK, "Commit");
+    Check(handle.EraseKey("str") == ESP_OK, "EraseKey");
+    nvs_type_t type;
+    Check(handle.FindKey("str", &type) == ESP_ERR_NVS_NOT_FOUND, "FindKey after EraseKey");
+    Check(handle.EraseAll() == ESP_OK, "EraseAll");
+    Check(handle.FindKey("blob", &type) == ESP_ERR_NVS_NOT_FOUND, "FindKey after EraseAll");
+    handle.Close();
+
+    Check(handle.Open("missing", NVS_READONLY) == ESP_ERR_NVS_NOT_FOUND,
+          "Open missing namespace read-only");
+}
+
+static void TestConfigServices() {
+    ResetPartition();
+    const char* error = nullptr;
+
+    Check(NvsConfig::SetKey("mqtt", "broker", Node("string", "mqtt://10.0.0.1").get(), &error) ==
+              ESP_OK,
+          "SetKey string");
+    Check(NvsConfig::SetKey("mqtt", "topic-base", Node("string", "fh/es2/").get(), &error) ==
+              ESP_OK,
+          "SetKey topic-base");
+    Check(NvsConfig::SetKey("system", "hostname", Node("string", "bench").get(), &error) ==
+              ESP_OK,
+          "SetKey hostname");
+    Check(NvsConfig::SetKey("app", "period", Node("uint16", 5000).get(), &error) == ESP_OK,
+          "SetKey integer");
+    Check(NvsConfig::SetKey("app", "key", Node("blob", "AAECAwQ=").get(), &error) == ESP_OK,
+          "SetKey blob");
+
+    Check(NvsConfig::SetKey("app", "bad", Node("float", 1).get(), &error) != ESP_OK &&
+              strcmp(error, "Unknown type") == 0,
+          "SetKey unknown type");
+    Check(NvsConfig::SetKey("app", "bad", Node("string", 1).get(), &error) != ESP_OK &&
+              strcmp(error, "Invalid type for integer value") == 0,
+          "SetKey type mismatch");
+
+    std::shared_ptr<cJSON> node(cJSON_CreateObject(), cJSON_Delete);
+    Check(NvsConfig::GetKey("app", "key", node.get(), &error) == ESP_OK, "GetKey blob");
+    cJSON* value = cJSON_GetObjectItemCaseSensitive(node.get(), "value");
+    Check(cJSON_IsString(value) && strcmp(value->valuestring, "AAECAwQ=") == 0,
+          "GetKey blob value");
+
+    node.reset(cJSON_CreateObject(), cJSON_Delete);
+    Check(NvsConfig::GetKey("app", "period", node.get(), &error) == ESP_OK, "GetKey integer");
+    value = cJSON_GetObjectItemCaseSensitive(node.get(), "value");
+    Check(cJSON_IsNumber(value) && value->valuedouble == 5000, "GetKey integer value");
+
+    // Read the keys the same way MQTT and App do at boot
+    NvsHandle handle;
+    char buffer[64];
+    size_t length = sizeof(buffer);
+    Check(handle.Open("mqtt", NVS_READONLY) == ESP_OK, "Open mqtt");
+    Check(handle.GetString("topic-base", buffer, &length) == ESP_OK &&
+              strcmp(buffer, "fh/es2/") == 0,
+          "MQTT topic-base");
+    length = sizeof(buffer);
+    Check(handle.GetString("broker", buffer, &length) == ESP_OK &&
+              strcmp(buffer, "mqtt://10.0.0.1") == 0,
+          "MQTT broker");
+    handle.Close();
+    length = sizeof(buffer);
+    Check(handle.Open("system", NVS_READONLY) == ESP_OK, "Open system");
+    Check(handle.GetString("hostname", buffer, &length) == ESP_OK && strcmp(buffer, "bench") == 0,
+          "System hostname");
+    handle.Close();
+
+    node.reset(cJSON_CreateObject(), cJSON_Delete);
+    Check(NvsConfig::GetAll(node.get(), &error) == ESP_OK, "GetAll");
+    Check(cJSON_GetObjectItemCaseSensitive(node.get(), "mqtt") != nullptr &&
+              cJSON_GetObjectItemCaseSensitive(node.get(), "system") != nullptr &&
+              cJSON_GetObjectItemCaseSensitive(node.get(), "app") != nullptr,
+          "GetAll namespaces");
+
+    Check(NvsConfig::DeleteKey("app", "key", &error) == ESP_OK, "DeleteKey");
+    node.reset(cJSON_CreateObject(), cJSON_Delete);
+    Check(NvsConfig::GetKey("app", "key", node.get(), &error) == ESP_ERR_NVS_NOT_FOUND,
+          "GetKey after DeleteKey");
+    Check(NvsConfig::DeleteNameSpace("app", &error) == ESP_OK, "DeleteNameSpace");
+    node.reset(cJSON_CreateObject(), cJSON_Delete);
+    Check(NvsConfig::GetKey("app", "period", node.get(), &error) == ESP_ERR_NVS_NOT_FOUND,
+          "GetKey after DeleteNameSpace");
+}
+
+static void TestConfigBundle() {
+    ResetPartition();
+    ConfigBundle* bundle = ConfigBundle::GetInstance();
+    static std::vector<uint8_t> data = BuildBundle();
+
+    std::vector<uint8_t> corrupted = data;
+    corrupted.back() ^= 0xff;
+    Check(bundle->Attach(corrupted.data(), corrupted.size()) == ESP_ERR_INVALID_CRC,
+          "Attach corrupted bundle");
+    Check(!bundle->IsMounted(), "Corrupted bundle not mounted");
+
+    // Find is a binary search: entries out of order are rejected
+    std::vector<uint8_t> unsorted = data;
+    uint8_t* entries = unsorted.data() + sizeof(ConfigBundle::Header);
+    std::swap_ranges(entries,
+                     entries + sizeof(ConfigBundle::Entry),
+                     entries + 2 * sizeof(ConfigBundle::Entry));
+    Reseal(unsorted);
+    Check(ConfigBundle::Validate(unsorted.data(), unsorted.size()) == ESP_ERR_INVALID_ARG,
+          "Unsorted bundle rejected");
+
+    // Strings must be NUL terminated within their length
+    std::vector<uint8_t> unterminated = data;
+    ConfigBundle::Entry entry;
+    memcpy(&entry, unterminated.data() + sizeof(ConfigBundle::Header), sizeof(entry));
+    entry.length--;
+    memcpy(unterminated.data() + sizeof(ConfigBundle::Header), &entry, sizeof(entry));
+    Reseal(unterminated);
+    Check(ConfigBundle::Validate(unterminated.data(), unterminated.size()) ==
+              ESP_ERR_INVALID_SIZE,
+          "Unterminated bundle string rejected");
+
+    // Integers must have the size of their type
+    std::vector<uint8_t> truncated = data;
+    uint8_t* port_entry = truncated.data() + sizeof(ConfigBundle::Header) + sizeof(entry);
+    memcpy(&entry, port_entry, sizeof(entry));
+    entry.length = 1;
+    memcpy(port_entry, &entry, sizeof(entry));
+    Reseal(truncated);
+    Check(ConfigBundle::Validate(truncated.data(), truncated.size()) == ESP_ERR_INVALID_SIZE,
+          "Truncated bundle integer rejected");
+
+    Check(bundle->Attach(data.data(), data.size()) == ESP_OK, "Attach bundle");
+    Check(bundle->Count() == 3, "Bundle count");
+
+    const char* broker = nullptr;
+    bundle->Lock();
+    Check(bundle->GetString("mqtt", "broker", &broker) == ESP_OK, "Bundle GetString");
+    Check(broker != nullptr && strcmp(broker, "mqtt://bundle") == 0, "Bundle GetString value");
+    Check(broker >= (const char*)data.data() && broker < (const char*)data.data() + data.size(),
+          "Bundle GetString is zero-copy");
+    double port = 0;
+    Check(bundle->GetInt("mqtt", "port", &port) == ESP_OK && port == 8883, "Bundle GetInt");
+    Check(bundle->Find("mqtt", "missing") == nullptr, "Bundle missing key");
+    Check(bundle->Find("zzz", "broker") == nullptr, "Bundle missing namespace");
+    bundle->Unlock();
+
+    // Bundle-only keys are reported like NVS keys
+    std::shared_ptr<cJSON> json(cJSON_CreateObject(), cJSON_Delete);
+    Check(NvsConfig::GetKey("system", "hostname", json.get()) == ESP_OK,
+          "GetKey from bundle");
+    cJSON* value = cJSON_GetObjectItemCaseSensitive(json.get(), "value");
+    Check(cJSON_IsString(value) && strcmp(value->valuestring, "fleet") == 0,
+          "GetKey bundle value");
+    json.reset(cJSON_CreateObject(), cJSON_Delete);
+    Check(NvsConfig::GetAll(json.get()) == ESP_OK, "GetAll with bundle");
+    Check(cJSON_GetObjectItemCaseSensitive(
+              cJSON_GetObjectItemCaseSensitive(json.get(), "mqtt"), "port") != nullptr,
+          "GetAll reports bundle keys");
+
+    // Hashes cover the same keys as GetAll
+    const uint32_t fleet = ConfigHash::Of("hostname", NVS_TYPE_STR, "fleet", 6);
+    uint32_t hash = 0;
+    std::map<std::string, uint32_t> keys;
+    Check(ConfigHash::Get("system", &hash, &keys) == ESP_OK && keys["hostname"] == fleet &&
+              hash == fleet,
+          "Hash includes bundle defaults");
+
+    // NVS falls back to the bundle, and takes precedence once a value is set
+    NvsHandle handle;
+    char buffer[64];
+    size_t length = sizeof(buffer);
+    Check(handle.Open("system", NVS_READONLY) == ESP_ERR_NVS_NOT_FOUND, "No system namespace");
+    Check(handle.GetString("hostname", buffer, &length) == ESP_OK && strcmp(buffer, "fleet") == 0,
+          "Hostname from bundle");
+    handle.Close();
+    Check(NvsConfig::SetKey("system", "hostname", Node("string", "device").get()) == ESP_OK,
+          "Override hostname");
+    length = sizeof(buffer);
+    Check(handle.Open("system", NVS_READONLY) == ESP_OK, "Open system");
+    Check(handle.GetString("hostname", buffer, &length) == ESP_OK && strcmp(buffer, "device") == 0,
+          "Hostname from NVS");
+    handle.Close();
+
+    Check(handle.Open("mqtt", NVS_READWRITE) == ESP_OK, "Open mqtt");
+    Check(handle.GetInt("port", NVS_TYPE_U16, &port) == ESP_OK && port == 8883,
+          "Port from bundle");
+    Check(handle.GetInt("port", NVS_TYPE_U32, &port) == ESP_ERR_NVS_TYPE_MISMATCH,
+          "Port type mismatch");
+    length = 4;
+    Check(handle.GetString("broker", buffer, &length) == ESP_ERR_NVS_INVALID_LENGTH,
+          "Bundle string too long for buffer");
+    handle.Close();
+
+    Check(ConfigHash::Get("system", &hash) == ESP_OK && hash != fleet, "Hash of the override");
+    NvsConfig::DeleteKey("system", "hostname");
+    Check(ConfigHash::Get("system", &hash) == ESP_OK && hash == fleet,
+          "Hash back to the bundle default");
+
+    bundle->Unmount();
+    Check(ConfigHash::Get("system", &hash) == ESP_OK && hash == 0, "Hash without bundle");
+}
+
+struct BoundConfig {
+    std::string broker;
+    std::string password = "default";
+    std::string missing = "default";
+    uint16_t port = 1883;
+    int32_t offset = 0;
+    bool enabled = false;
+};
+
+static const NvsBinding<BoundConfig> kBinding = NvsBinding<BoundConfig>("mqtt")
+                                                    .Bind("broker", &BoundConfig::broker)
+                                                    .Bind("password", &BoundConfig::password)
+                                                    .Bind("missing", &BoundConfig::missing)
+                                                    .Bind("port", &BoundConfig::port)
+                                                    .Bind("offset", &BoundConfig::offset)
+                                                    .Bind("enabled", &BoundConfig::enabled);
+
+static void TestBinding() {
+    ResetPartition();
+    BoundConfig config;
+    Check(kBinding.Load(&config) == 0, "Load from missing namespace");
+    Check(config.port == 1883 && config.missing == "default", "Defaults kept");
+
+    // Longer than the 64 bytes MQTT used to read, and than the first read buffer
+    std::string password(150, 'p');
+    NvsConfig::SetKey("mqtt", "broker", Node("string", "mqtt://10.0.0.1").get());
+    NvsConfig::SetKey("mqtt", "password", Node("string", password.c_str()).get());
+    NvsConfig::SetKey("mqtt", "port", Node("uint16", 8883).get());
+    NvsConfig::SetKey("mqtt", "offset", Node("int32", -5).get());
+    NvsConfig::SetKey("mqtt", "enabled", Node("uint8", 1).get());
+
+    Check(kBinding.Load(&config) == 5, "Load found fields");
+    Check(config.broker == "mqtt://10.0.0.1", "Bound string");
+    Check(config.password == password, "Bound long string");
+    Check(config.missing == "default", "Bound missing key");
+    Check(config.port == 8883 && config.offset == -5 && config.enabled, "Bound integers");
+
+    // Fields missing from NVS come from the bundle
+    ResetPartition();
+    std::vector<uint8_t> data = BuildBundle();
+    ConfigBundle::GetInstance()->Attach(data.data(), data.size());
+    BoundConfig from_bundle;
+    Check(kBinding.Load(&from_bundle) == 2, "Load from bundle");
+    Check(from_bundle.broker == "mqtt://bundle" && from_bundle.port == 8883, "Bundle fields");
+    ConfigBundle::GetInstance()->Unmount();
+}
+
+static void TestRouting() {
+    ResetPartition();
+    NvsHandle::RouteNameSpace("heavy", NvsHandle::kAppPartition);
+    NvsHandle::RouteNameSpace("lost", "no-such-partition");
+    Check(strcmp(NvsHandle::PartitionOf("heavy"), NvsHandle::kAppPartition) == 0,
+          "Routed namespace");
+    Check(strcmp(NvsHandle::PartitionOf("mqtt"), "nvs") == 0, "Default namespace");
+    Check(strcmp(NvsHandle::PartitionOf("lost"), "nvs") == 0, "Route to missing partition");
+
+    Check(NvsConfig::SetKey("heavy", "counter", Node("uint32", 1).get()) == ESP_OK,
+          "SetKey routed");
+    Check(NvsConfig::SetKey("mqtt", "broker", Node("string", "mqtt://x").get()) == ESP_OK,
+          "SetKey default");
+    Check(CountEntries(NvsHandle::kAppPartition, "heavy") == 1, "Routed key in app partition");
+    Check(CountEntries("nvs", "heavy") == 0, "Routed key not in default partition");
+    Check(CountEntries(NvsHandle::kAppPartition, "mqtt") == 0, "Default key not in app partition");
+
+    std::shared_ptr<cJSON> node(cJSON_CreateObject(), cJSON_Delete);
+    Check(NvsConfig::GetAll(node.get()) == ESP_OK, "GetAll with routes");
+    Check(cJSON_GetObjectItemCaseSensitive(node.get(), "heavy") != nullptr &&
+              cJSON_GetObjectItemCaseSensitive(node.get(), "mqtt") != nullptr,
+          "GetAll iterates both partitions");
+}
+
+// ----- Benchmarks -----
+
+static double ProfileLevel() {
+    std::shared_ptr<cJSON> node(cJSON_CreateObject(), cJSON_Delete);
+    if (NvsConfig::GetKey("prof", "level", node.get()) != ESP_OK) {
+        return -1;
+    }
+    return cJSON_GetObjectItemCaseSensitive(node.get(), "value")->valuedouble;
+}
+
+static void TestProfiles() {
+    ResetPartition();
+    static int changes = 0;
+    NvsConfig::OnChange([](const char* name_space, const char* key) {
+        changes += strcmp(name_space, "prof") == 0 && strcmp(key, "level") == 0;
+    });
+    ConfigProfiles* profiles = ConfigProfiles::GetInstance();
+    Check(NvsConfig::SetKey("prof", "level", Node("uint8", 1).get()) == ESP_OK,
+          "SetKey before protection");
+    Check(changes == 1, "Change of the running configuration reported");
+
+    profiles->Protect("prof");
+    Check(profiles->Init() == ESP_OK, "Init profiles");
+    Check(CountEntries("nvs", "prof") == 0 && CountEntries("nvs", "prof@0") == 1,
+          "Namespace moved to active slot");
+    Check(profiles->ActiveSlot() == 0 && profiles->GetState() == ConfigProfiles::kIdle,
+          "Initial profile");
+    Check(ProfileLevel() == 1, "Read through alias");
+
+    Check(NvsConfig::SetKey("prof", "level", Node("uint8", 2).get()) == ESP_OK, "Stage change");
+    Check(profiles->GetState() == ConfigProfiles::kStaged && changes == 1,
+          "Profile staged, change not reported");
+    Check(ProfileLevel() == 1, "Staged change not active");
+    Check(profiles->Activate() == ESP_OK, "Activate");
+    Check(ProfileLevel() == 1, "Activated profile applies after reboot");
+
+    Check(profiles->Init() == ESP_OK && profiles->PendingVerification(), "Trial boot");
+    Check(profiles->ActiveSlot() == 1 && ProfileLevel() == 2, "New profile active");
+    Check(NvsConfig::SetKey("prof", "level", Node("uint8", 9).get()) == ESP_ERR_INVALID_STATE,
+          "No changes while pending verification");
+
+    Check(profiles->Init() == ESP_OK && !profiles->PendingVerification(),
+          "Unverified profile rolled back at boot");
+    Check(profiles->ActiveSlot() == 0 && ProfileLevel() == 1, "Previous profile active");
+
+    NvsConfig::SetKey("prof", "level", Node("uint8", 3).get());
+    profiles->Activate();
+    profiles->Init();
+    Check(profiles->Commit() == ESP_OK, "Commit");
+    profiles->Init();
+    Check(profiles->GetState() == ConfigProfiles::kConfirmed && ProfileLevel() == 3,
+          "Committed profile kept");
+    Check(profiles->Rollback() == ESP_OK && ProfileLevel() == 1, "Instant rollback");
+
+    std::shared_ptr<cJSON> node(cJSON_CreateObject(), cJSON_Delete);
+    Check(NvsConfig::GetAll(node.get()) == ESP_OK, "GetAll with profiles");
+    Check(cJSON_GetObjectItemCaseSensitive(node.get(), "prof") != nullptr &&
+              cJSON_GetObjectItemCaseSensitive(node.get(), "prof@0") == nullptr &&
+              cJSON_GetObjectItemCaseSensitive(node.get(), "prof@1") == nullptr,
+          "GetAll reports logical namespace only");
+}
+
+static void TestConfigHash() {
+    ResetPartition();
+    NvsConfig::SetKey("hash", "broker", Node("string", "mqtt://x").get());
+    NvsConfig::SetKey("hash", "port", Node("uint16", 1883).get());
+
+    uint32_t hash;
+    std::map<std::string, uint32_t> keys;
+    Check(ConfigHash::Get("hash", &hash, &keys) == ESP_OK, "Hash namespace");
+    // Same values as tools/confighash.py
+    Check(keys["broker"] == 0x1ae42d02 && keys["port"] == 0x3a9b5d62, "Key hashes");
+    Check(hash == 0x207f7060, "Namespace hash");
+
+    NvsConfig::SetKey("hash", "port", Node("uint16", 8883).get());
+    NvsConfig::SetKey("hash", "extra", Node("blob", "AAEC").get());
+    NvsConfig::DeleteKey("hash", "extra");
+    uint32_t incremental;
+    Check(ConfigHash::Get("hash", &incremental) == ESP_OK && incremental != hash,
+          "Hash updated on write");
+    ConfigHash::Invalidate("hash");
+    uint32_t rebuilt;
+    Check(ConfigHash::Get("hash", &rebuilt) == ESP_OK && rebuilt == incremental,
+          "Incremental hash matches rebuild");
+
+    std::shared_ptr<cJSON> request(
+        cJSON_Parse("{\"hash\": {\"hash\": \"207f7060\","
+                    " \"keys\": {\"broker\": \"1ae42d02\", \"port\": \"3a9b5d62\","
+                    " \"gone\": \"00000000\"}}, \"empty\": \"00000000\"}"),
+        cJSON_Delete);
+    std::shared_ptr<cJSON> node(cJSON_CreateObject(), cJSON_Delete);
+    Check(NvsConfig::Diff(request.get(), node.get()) == ESP_OK, "Diff");
+    cJSON* diff_ns = cJSON_GetObjectItemCaseSensitive(node.get(), "hash");
+    cJSON* diff_keys = cJSON_GetObjectItemCaseSensitive(diff_ns, "keys");
+    Check(cJSON_GetArraySize(node.get()) == 1, "Only the differing namespace");
+    Check(cJSON_GetArraySize(diff_keys) == 2 &&
+              cJSON_IsString(cJSON_GetObjectItemCaseSensitive(diff_keys, "port")) &&
+              cJSON_IsNull(cJSON_GetObjectItemCaseSensitive(diff_keys, "gone")),
+          "Only the differing keys");
+}
+
+static double SyncValue(const char* key) {
+    NvsHandle handle;
+    double value = -1;
+    handle.Open("sync", NVS_READONLY);
+    handle.GetInt(key, NVS_TYPE_U8, &value);
+    return value;
+}
+
+static void TestConfigSync() {
+    ResetPartition();
+    ConfigSync* sync = ConfigSync::GetInstance();
+    const char* device_v1 =
+        "{\"version\": 1, \"config\": {\"sync\": {\"a\": {\"type\": \"uint8\", \"value\": 1}}}}";
+    const char* group_v1 =
+        "{\"version\": 1, \"config\": {\"sync\": {\"a\": {\"type\": \"uint8\", \"value\": 2},"
+        " \"b\": {\"type\": \"uint8\", \"value\": 3}}}}";
+
+    Check(sync->Apply(ConfigSync::kDevice, device_v1, strlen(device_v1)) == ESP_OK,
+          "Apply device document");
+    Check(sync->Version(ConfigSync::kDevice) == 1 && SyncValue("a") == 1, "Device key set");
+
+#ifdef CONFIG_ESP_PARTITION_ENABLE_STATS
+    esp_partition_clear_stats();
+#endif
+    Check(sync->Apply(ConfigSync::kDevice, device_v1, strlen(device_v1)) == ESP_OK,
+          "Apply same document again");
+#ifdef CONFIG_ESP_PARTITION_ENABLE_STATS
+    Check(esp_partition_get_write_bytes() == 0, "Same version does not write to flash");
+#endif
+
+    Check(sync->Apply(ConfigSync::kGroup, group_v1, strlen(group_v1)) == ESP_OK,
+          "Apply group document");
+    Check(SyncValue("a") == 1 && SyncValue("b") == 3, "Device keys take precedence");
+
+    const char* invalid = "{\"config\": {}}";
+    const char* error = nullptr;
+    Check(sync->Apply(ConfigSync::kDevice, invalid, strlen(invalid), nullptr, &error) ==
+                  ESP_ERR_INVALID_ARG &&
+              error != nullptr,
+          "Document without version rejected");
+}
+
+static void Bench(const char* name, int iterations, std::function<esp_err_t(int)> operation) {
+#ifdef CONFIG_ESP_PARTITION_ENABLE_STATS
+    esp_partition_clear_stats();
+#endif
+    int errors = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        if (operation(i) != ESP_OK) {
+            errors++;
+        }
+    }
+    auto stop = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(stop - start).count();
+
+    double bytes_per_op = 0;
+    double erases_per_op = 0;
+#ifdef CONFIG_ESP_PARTITION_ENABLE_STATS
+    bytes_per_op = (double)esp_partition_get_write_bytes() / iterations;
+    erases_per_op = (double)esp_partition_get_erase_ops() / iterations;
+#endif
+    Check(errors == 0, name);
+    // One line per benchmark, easy to grep and compare on CI
+    printf("BENCH %-24s ops=%d ops/s=%.0f bytes/op=%.1f erases/op=%.3f errors=%d\n",
+           name,
+           iterations,
+           iterations / seconds,
+           bytes_per_op,
+           erases_per_op,
+           errors);
+}
+
+static void RunBenchmarks() {
+    ResetPartition();
+    NvsHandle handle;
+    ESP_ERROR_CHECK(handle.Open("bench", NVS_READWRITE));
+
+    Bench("set-u32+commit", kIterations, [&](int i) {
+        esp_err_t err = handle.SetInt("u32", NVS_TYPE_U32, i);
+        return err == ESP_OK ? handle.Commit() : err;
+    });
+    Bench("set-u32-same+commit", kIterations, [&](int i) {
+        esp_err_t err = handle.SetInt("u32", NVS_TYPE_U32, 42);
+        return err == ESP_OK ? handle.Commit() : err;
+    });
+    Bench("get-u32", kIterations * 10, [&](int i) {
+        double value;
+        return handle.GetInt("u32", NVS_TYPE_U32, &value);
+    });
+
+    Bench("set-str32+commit", kIterations, [&](int i) {
+        char value[33];
+        snprintf(value, sizeof(value), "mqtt://broker-%017d.local", i);
+        esp_err_t err = handle.SetString("str", value);
+        return err == ESP_OK ? handle.Commit() : err;
+    });
+    Bench("get-str32", kIterations * 10, [&](int i) {
+        char value[64];
+        size_t length = sizeof(value);
+        return handle.GetString("str", value, &length);
+    });
+
+    uint8_t blob[256];
+    memset(blob, 0xa5, sizeof(blob));
+    Bench("set-blob256+commit", kIterations, [&](int i) {
+        blob[0] = i;
+        esp_err_t err = handle.SetBlob("blob", blob, sizeof(blob));
+        return err == ESP_OK ? handle.Commit() : err;
+    });
+    Bench("get-blob256", kIterations * 10, [&](int i) {
+        size_t length = sizeof(blob);
+        return handle.GetBlob("blob", blob, &length);
+    });
+    Bench("find-key", kIterations * 10, [&](int i) {
+        nvs_type_t type;
+        return handle.FindKey("blob", &type);
+    });
+    handle.Close();
+
+    Bench("routed-set-u32+commit", kIterations, [&](int i) {
+        NvsHandle h;
+        esp_err_t err = h.Open("heavy", NVS_READWRITE);
+        if (err == ESP_OK) {
+            err = h.SetInt("u32", NVS_TYPE_U32, i);
+        }
+        return err == ESP_OK ? h.Commit() : err;
+    });
+
+    Bench("open+close", kIterations * 10, [&](int i) {
+        NvsHandle h;
+        return h.Open("bench", NVS_READONLY);
+    });
+
+    Bench("config-set-key", kIterations, [&](int i) {
+        std::shared_ptr<cJSON> node = Node("string", std::to_string(i).c_str());
+        return NvsConfig::SetKey("mqtt", "broker", node.get());
+    });
+    NvsConfig::SetKey("mqtt", "password", Node("string", "secret").get());
+    NvsConfig::SetKey("mqtt", "port", Node("uint16", 8883).get());
+    Bench("binding-load(6 fields)", kIterations * 10, [&](int i) {
+        BoundConfig config;
+        return kBinding.Load(&config) >= 0 ? ESP_OK : ESP_FAIL;
+    });
+
+    Bench("config-get-key", kIterations * 10, [&](int i) {
+        std::shared_ptr<cJSON> node(cJSON_CreateObject(), cJSON_Delete);
+        return NvsConfig::GetKey("mqtt", "broker", node.get());
+    });
+
+    for (int i = 0; i < 32; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "key-%d", i);
+        NvsConfig::SetKey("many", key, Node("uint32", i).get());
+    }
+    Bench("config-get-all", kIterations, [&](int i) {
+        std::shared_ptr<cJSON> node(cJSON_CreateObject(), cJSON_Delete);
+        return NvsConfig::GetAll(node.get());
+    });
+
+    std::shared_ptr<cJSON> hashes(cJSON_CreateObject(), cJSON_Delete);
+    cJSON_AddStringToObject(hashes.get(), "many", "00000000");
+    cJSON_AddStringToObject(hashes.get(), "mqtt", "00000000");
+    Bench("config-diff(2 ns)", kIterations, [&](int i) {
+        std::shared_ptr<cJSON> node(cJSON_CreateObject(), cJSON_Delete);
+        return NvsConfig::Diff(hashes.get(), node.get());
+    });
+
+    ConfigBundle* bundle = ConfigBundle::GetInstance();
+    std::vector<uint8_t> data = BuildBundle();
+    bundle->Attach(data.data(), data.size());
+    Bench("bundle-get-string", kIterations * 10, [&](int i) {
+        const char* value;
+        return bundle->GetString("system", "hostname", &value);
+    });
+    Bench("nvs-fallback-get-string", kIterations * 10, [&](int i) {
+        NvsHandle h;
+        h.Open("system", NVS_READONLY);
+        char value[64];
+        size_t length = sizeof(value);
+        return h.GetString("hostname", value, &length);
+    });
+    bundle->Unmount();
+}
+
+void app_main(void) {
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ESP_ERROR_CHECK(nvs_flash_init());
+    }
+    ESP_ERROR_CHECK(NvsHandle::InitPartition(NvsHandle::kAppPartition));
+
+    TestTypeNames();
+    TestHandle();
+    TestConfigServices();
+    TestConfigBundle();
+    TestBinding();
+    TestRouting();
+    TestProfiles();
+    TestConfigHash();
+    TestConfigSync();
+    RunBenchmarks();
+
+    if (failures > 0) {
+        ESP_LOGE(kTag, "%d check(s) failed", failures);
+        exit(EXIT_FAILURE);
+    }
+    ESP_LOGI(kTag, "All checks passed");
+    exit(EXIT_SUCCESS);
+}
@@ -19,15 +19,30 @@
 #include <esp_wifi.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
 
+#include <string_view>
+
+#include "cJSON.h"
+#include "config_profiles.hpp"
+#include "config_sync.hpp"
 #include "firmware_updater.hpp"
 #include "httpd.hpp"
 #include "mqtt.hpp"
+#include "nvs_config.hpp"
+#include "persistent_counters.hpp"
 #include "provisioner.hpp"
 #include "status_led.hpp"
 
 class App {
    public:
+    // From the first MQTT connection attempt, not from the start
+    static constexpr int kConfigHealthCheckTimeout = 60;  // seconds
+
+    struct Config {
+        std::string hostname;
+    };
+
     static App* GetInstance();
 
     void Init(StatusLed* led);
@@ -40,58 +55,106 @@ class App {
         httpd_->AddRoute(uri, method, handler, user_ctx);
     }
 
+    void RouteNvsNameSpace(const char* name_space,
+                           const char* partition = NvsHandle::kAppPartition) {
+        NvsHandle::RouteNameSpace(name_space, partition);
+    }
+
     esp_err_t StartMdns(const char* name);
     void StartHttpd(size_t stack_size, int max_uri_handlers) {
         httpd_->Start(stack_size, max_uri_handlers);
     }
 
-    esp_err_t InitMQTT(MQTT::LastWill* last_will = nullptr, int keep_alive = 120) {
-        return mqtt_->Init(last_will, keep_alive);
-    }
-    void AddSubscription(const char* topic, bool prefixed = true, int qos = 1) {
-        if (prefixed) {
-            mqtt_->AddSubscription(mqtt_->Prefixed(topic).c_str(), qos);
-        } else {
-            mqtt_->AddSubscription(topic, qos);
-        }
+    // Also subscribes to the configuration topics (see ConfigSync). Subscription
+    // handlers, App's own among them, write NVS and may restart the device: they run
+    // on `inbound_workers` tasks (see MQTT::SetInboundWorkers), or on the MQTT task
+    // with 0.
+    esp_err_t InitMQTT(MQTT::LastWill* last_will = nullptr,
+                       int keep_alive = 120,
+                       int inbound_workers = 1);
+    void AddSubscription(const char* topic,
+                         bool prefixed = true,
+                         int qos = 1,
+                         TopicTrie::Handler handler = nullptr) {
+        mqtt_->AddSubscription(topic, qos, handler, prefixed);
     }
     esp_err_t RegisterMQTTEventHandler(esp_mqtt_event_id_t event,
                                        esp_event_handler_t event_handler,
                                        void* event_handler_arg) {
         return mqtt_->RegisterEventHandler(event, event_handler, event_handler_arg);
     }
-    esp_err_t StartMQTT() { return mqtt_->Start(); }
-    std::string TopicBase() { return mqtt_->topic_base_; }
+    esp_err_t StartMQTT();
+    std::string TopicBase() { return mqtt_->TopicBase(); }
+    MQTT::TopicHandle RegisterTopic(const char* topic, bool prefixed = true) {
+        return mqtt_->RegisterTopic(topic, prefixed);
+    }
     esp_err_t PublishMessage(
         const char* topic, const char* data, bool prefixed = true, int qos = 1, int retain = 0);
+    esp_err_t PublishMessage(MQTT::TopicHandle topic,
+                             const char* data,
+                             int qos = 1,
+                             int retain = 0) {
+        return mqtt_->Publish(topic, data, 0, qos, retain);
+    }
+    // Returns without waiting for the network (see MQTT::PublishAsync)
+    esp_err_t PublishMessageAsync(const char* topic,
+                                  const char* data,
+                                  bool prefixed = true,
+                                  int qos = 1,
+                                  int retain = 0,
+                                  MQTT::PublishCallback done = nullptr,
+                                  int timeout_ms = MQTT::kPublishTimeoutMs);
 
     bool PendingUpdateVerification() { return updater_->PendingVerification(); }
     void CommitUpdate() { updater_->Commit(); }
     void RollbackUpdate() { updater_->Rollback(); }
 
+    // Configuration profiles (see ConfigProfiles). A newly activated profile is
+    // committed once MQTT connects; StartMQTT() arms this health check.
+    bool PendingConfigVerification() { return profiles_->PendingVerification(); }
+    void CommitConfig() { profiles_->Commit(); }
+    void RollbackConfig();
+    void StartConfigHealthCheck(int timeout_sec = kConfigHealthCheckTimeout);
+
+    // Device information, as returned by GET /info
+    void GetInfo(cJSON* node);
+
     StatusLed* GetStatusLed() { return led_; }
     Httpd* GetHttpd() { return httpd_; }
     MQTT* GetMQTT() { return mqtt_; }
 
+    // Hostname in use, read back from the Wi-Fi interface once provisioned: the
+    // configured config_.hostname, or the esp_netif default when it is empty. mDNS
+    // announces this one.
     char hostname_[32];
+    Config config_;
 
     StatusLed* led_ = nullptr;
     Httpd* httpd_;
     MQTT* mqtt_;
     Updater* updater_;
     Provisioner* prov_;
+    ConfigProfiles* profiles_;
+    ConfigSync* config_sync_;
+    PersistentCounters* counters_;
 
    private:
     static App* instance_;
     static SemaphoreHandle_t semaphore_;
 
     static esp_err_t DoFirmwareUpgrade(httpd_req_t* req);
+    static esp_err_t DoConfigBundleUpgrade(httpd_req_t* req);
     static esp_err_t DoReset(httpd_req_t* req);
     static esp_err_t DoConfigSetKey(httpd_req_t* req);
     static esp_err_t DoConfigGetKey(httpd_req_t* req);
     static esp_err_t DoConfigGetAll(httpd_req_t* req);
     static esp_err_t DoConfigDeleteKey(httpd_req_t* req);
     static esp_err_t DoConfigDeleteNameSpace(httpd_req_t* req);
+    static esp_err_t DoConfigDiff(httpd_req_t* req);
+    static esp_err_t DoConfigProfile(httpd_req_t* req);
+    static esp_err_t DoConfigActivate(httpd_req_t* req);
+    static esp_err_t DoConfigRollback(httpd_req_t* req);
+    static esp_err_t DoConfigDiscard(httpd_req_t* req);
     static esp_err_t DoGetInfo(httpd_req_t* req);
     static esp_err_t DoInfo(httpd_req_t* req);
 
@@ -101,9 +164,29 @@ class App {
     }
     void ReprovionerTask();
 
+    void ApplyConfig(ConfigSync::Source source, std::string_view topic, std::string_view payload);
+
+    // Configuration RPC over MQTT (see nvs_config_rpc.cpp)
+    void InitRpc();
+    void HandleRpc(std::string_view payload);
+    esp_err_t CallRpc(const char* method,
+                      const cJSON* params,
+                      cJSON* response,
+                      const char** error);
+
+    static void ConfigHealthTaskForwarder(void* arg) {
+        App* instance = static_cast<App*>(arg);
+        instance->ConfigHealthTask();
+    }
+    void ConfigHealthTask();
+
     App();
     App(App const&) = delete;
     void operator=(App const&) = delete;
 
     esp_netif_t* wifi_ = nullptr;
+    MQTT::TopicHandle rpc_response_topic_;
+    TaskHandle_t health_task_ = nullptr;
+    int64_t health_timeout_ = 0;   // us
+    int64_t health_deadline_ = 0;  // 0: no connection attempt yet
 };
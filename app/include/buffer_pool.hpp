@@ -0,0 +1,45 @@
+/**
+ ******************************************************************************
+ * @file        : buffer_pool.hpp
+ * @brief       : Fixed Buffer Pool
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : A fixed number of equally sized buffers, allocated once (in
+ *                PSRAM when available). A buffer returns to the pool when the
+ *                last std::shared_ptr to it is released.
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <memory>
+#include <vector>
+
+class BufferPool {
+   public:
+    BufferPool() : mutex_(xSemaphoreCreateMutex()) {}
+    BufferPool(BufferPool const&) = delete;
+    void operator=(BufferPool const&) = delete;
+
+    esp_err_t Init(size_t count, size_t size);
+    std::shared_ptr<char> Acquire();  // nullptr if all buffers are in use
+
+    size_t BufferSize() const { return size_; }
+    size_t Available();
+
+   private:
+    void Release(char* buffer);
+
+    SemaphoreHandle_t mutex_;
+    std::shared_ptr<char> storage_;
+    std::vector<char*> free_;
+    size_t size_ = 0;
+};
@@ -0,0 +1,127 @@
+/**
+ ******************************************************************************
+ * @file        : config_bundle.hpp
+ * @brief       : Read-only Configuration Bundle
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Fleet-wide configuration defaults, stored in a dedicated data
+ *                partition and memory mapped. Lookups return pointers into the
+ *                mapped flash (no copy). Values from NVS take precedence.
+ *
+ *                Bundle layout (all integers little endian):
+ *
+ *                  Header   magic "HTCB" (u32), version (u16), count (u16),
+ *                           size (u32, header included), crc32 (u32, of the
+ *                           bytes following the header)
+ *                  Entries  count x {namespace (u32), key (u32), value (u32),
+ *                           length (u16), type (u8, nvs_type_t), reserved (u8)}
+ *                           sorted by namespace, then key. namespace, key and
+ *                           value are offsets from the start of the bundle.
+ *                  Data     NUL terminated names, values. Integers use the
+ *                           size of their type, strings include the NUL.
+ *
+ *                Bundles are generated with tools/mkconfigbundle.py from a
+ *                JSON document in the /config/get-all format.
+ *
+ *                An optional second partition, "<label>_b", holds the next
+ *                bundle while the current one stays mapped: updates are written
+ *                to the inactive slot, validated, then swapped in.
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <esp_err.h>
+#include <esp_partition.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <nvs.h>
+
+class ConfigBundle {
+   public:
+    static constexpr uint32_t kMagic = 0x42435448;  // "HTCB"
+    static constexpr uint16_t kVersion = 1;
+
+    struct __attribute__((packed)) Header {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t count;
+        uint32_t size;
+        uint32_t crc;
+    };
+
+    struct __attribute__((packed)) Entry {
+        uint32_t name_space;
+        uint32_t key;
+        uint32_t value;
+        uint16_t length;
+        uint8_t type;
+        uint8_t reserved;
+    };
+
+    static ConfigBundle* GetInstance();
+
+    // Maps the first slot ("<label>", then "<label>_b") that holds a valid bundle
+    esp_err_t Mount(const char* label = "config");
+    esp_err_t Attach(const void* data, size_t size);
+    void Unmount();
+
+    // Slot to write the next bundle into, or nullptr if there is no second slot
+    const esp_partition_t* InactiveSlot(const char* label = "config");
+    // Maps a freshly written slot and swaps it in. The previous slot is erased so
+    // that the next boot mounts the new bundle.
+    esp_err_t Activate(const esp_partition_t* partition);
+    // Single slot update: rewrites the mapped partition in place. Lookups wait
+    // until it is done, but a power loss during the write leaves no bundle.
+    esp_err_t Replace(const esp_partition_t* partition, const void* data, size_t size);
+
+    // Lookups return pointers into the mapped bundle, which an update unmaps. Hold
+    // the lock from the lookup until the value has been copied.
+    void Lock() { xSemaphoreTake(mutex_, portMAX_DELAY); }
+    void Unlock() { xSemaphoreGive(mutex_); }
+
+    bool IsMounted() { return header_ != nullptr; }
+    uint16_t Count() { return IsMounted() ? header_->count : 0; }
+    const Entry* At(uint16_t index) { return index < Count() ? &entries_[index] : nullptr; }
+    const char* String(uint32_t offset) { return (const char*)base_ + offset; }
+
+    const Entry* Find(const char* name_space, const char* key);
+
+    esp_err_t Get(const char* name_space,
+                  const char* key,
+                  nvs_type_t* type,
+                  const void** value,
+                  size_t* length);
+    esp_err_t GetString(const char* name_space, const char* key, const char** value);
+    esp_err_t GetInt(const char* name_space, const char* key, double* value);
+
+    static esp_err_t Validate(const void* data, size_t size);
+
+   private:
+    static ConfigBundle* instance_;
+    static SemaphoreHandle_t semaphore_;
+
+    ConfigBundle(){};
+    ConfigBundle(ConfigBundle const&) = delete;
+    void operator=(ConfigBundle const&) = delete;
+
+    static esp_err_t Map(const esp_partition_t* partition,
+                         const void** data,
+                         esp_partition_mmap_handle_t* handle);
+    void Install(const void* data,
+                 const esp_partition_t* partition,
+                 esp_partition_mmap_handle_t handle,
+                 bool mapped);
+
+    SemaphoreHandle_t mutex_ = xSemaphoreCreateMutex();
+    const esp_partition_t* partition_ = nullptr;
+    const uint8_t* base_ = nullptr;
+    const Header* header_ = nullptr;
+    const Entry* entries_ = nullptr;
+    esp_partition_mmap_handle_t mmap_handle_ = 0;
+    bool mapped_ = false;
+};
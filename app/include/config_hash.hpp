@@ -0,0 +1,67 @@
+/**
+ ******************************************************************************
+ * @file        : config_hash.hpp
+ * @brief       : Configuration Content Hashes
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Every key has a hash:
+ *
+ *                  crc32(key, NUL, type (u8, nvs_type_t), value)
+ *
+ *                where the value is encoded as in the configuration bundle
+ *                (integers little endian in the size of their type, strings
+ *                with their NUL, blobs raw). The hash of a namespace is the XOR
+ *                of the hashes of its keys, so that it can be updated in O(1)
+ *                on every write. The keys are those /config/get-all reports:
+ *                the NVS keys and the bundle defaults they do not override.
+ *                tools/confighash.py computes the same hashes from a
+ *                /config/get-all document.
+ *
+ *                Hashes are cached per physical namespace, built on first use,
+ *                and kept up to date by NvsHandle and ConfigBundle. Code writing
+ *                to NVS through the raw nvs_* API must call Invalidate().
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <nvs.h>
+
+#include <map>
+#include <string>
+
+class ConfigHash {
+   public:
+    static uint32_t Of(const char* key, nvs_type_t type, const void* value, size_t length);
+    static uint32_t OfInt(const char* key, nvs_type_t type, double value);
+
+    // `name_space` is a logical namespace (aliases are resolved)
+    static esp_err_t Get(const char* name_space,
+                         uint32_t* hash,
+                         std::map<std::string, uint32_t>* keys = nullptr);
+
+    // Called on writes to the physical namespace `name_space`
+    static void Set(const char* name_space, const char* key, uint32_t hash);
+    static void Erase(const char* name_space, const char* key);
+    static void Clear(const char* name_space);
+    static void Invalidate(const char* name_space = nullptr);  // nullptr: all namespaces
+
+   private:
+    struct NameSpace {
+        uint32_t hash = 0;
+        std::map<std::string, uint32_t> keys;
+    };
+
+    static esp_err_t Build(const char* partition, const char* name_space, NameSpace* ns);
+    static esp_err_t BuildFromNvs(const char* partition, const char* name_space, NameSpace* ns);
+
+    static std::map<std::string, NameSpace> cache_;
+    static SemaphoreHandle_t semaphore_;
+};
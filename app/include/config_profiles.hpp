@@ -0,0 +1,83 @@
+/**
+ ******************************************************************************
+ * @file        : config_profiles.hpp
+ * @brief       : A/B Configuration Profiles
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Protected namespaces are stored in two slots ("<ns>@0" and
+ *                "<ns>@1"). A single active-slot pointer selects the slot that
+ *                NvsHandle::Open("<ns>") reads. Configuration writes go to the
+ *                other (staging) slot; activating flips the pointer, and the
+ *                new profile must be committed after a health check, like an
+ *                OTA image pending verification. Rollback flips it back.
+ *
+ *                  idle/confirmed --write--> staged --activate--> trial
+ *                  trial --reboot--> trying --commit--> confirmed
+ *                  trying --reboot or rollback--> idle (previous slot active)
+ *
+ *                Staging from the confirmed state copies the running profile
+ *                over the inactive slot: the previous known-good profile is
+ *                dropped, and rollback then returns to the running one.
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <string>
+#include <vector>
+
+class ConfigProfiles {
+   public:
+    enum State : uint8_t {
+        kIdle = 0,       // the inactive slot holds nothing useful
+        kStaged = 1,     // the inactive slot holds pending changes
+        kTrial = 2,      // activated, waiting for the next boot
+        kTrying = 3,     // running the new profile, waiting for Commit()
+        kConfirmed = 4,  // the inactive slot holds the previous profile
+    };
+
+    static ConfigProfiles* GetInstance();
+
+    void Protect(const char* name_space);
+    bool IsProtected(const char* name_space);
+    esp_err_t Init();
+
+    State GetState() { return state_; }
+    static const char* StateName(State state);
+    uint8_t ActiveSlot() { return active_; }
+
+    // Returns the slot namespace to write `name_space` changes to. From kConfirmed,
+    // this overwrites the previous profile (see above).
+    esp_err_t Stage(const char* name_space, std::string* staging);
+    esp_err_t Activate();
+    esp_err_t Discard();
+
+    bool PendingVerification() { return state_ == kTrying; }
+    esp_err_t Commit();
+    esp_err_t Rollback();
+
+   private:
+    static ConfigProfiles* instance_;
+    static SemaphoreHandle_t semaphore_;
+
+    ConfigProfiles(){};
+    ConfigProfiles(ConfigProfiles const&) = delete;
+    void operator=(ConfigProfiles const&) = delete;
+
+    static std::string SlotName(const std::string& name_space, uint8_t slot);
+    esp_err_t Save(uint8_t active, State state);
+    void UpdateAliases();
+
+    std::vector<std::string> name_spaces_;
+    uint8_t active_ = 0;
+    State state_ = kIdle;
+    bool initialized_ = false;
+};
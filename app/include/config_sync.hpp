@@ -0,0 +1,72 @@
+/**
+ ******************************************************************************
+ * @file        : config_sync.hpp
+ * @brief       : Configuration Delivery
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Applies configuration documents pushed to the device (as
+ *                retained MQTT messages, on a per-device and a per-group
+ *                topic):
+ *
+ *                  {"version": 7, "activate": true,
+ *                   "config": {"mqtt": {"broker": {"type": "string",
+ *                                                  "value": "mqtt://..."}}}}
+ *
+ *                Keys are written with NvsConfig::SetKey, like /config/set-key.
+ *                A document is applied once: versions not greater than the last
+ *                applied one (per source) are ignored, so that the retained
+ *                messages received on every reconnect do not rewrite the flash.
+ *                Keys of the device document take precedence over the group.
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <set>
+#include <string>
+#include <utility>
+
+class ConfigSync {
+   public:
+    enum Source { kDevice = 0, kGroup = 1 };
+
+    struct Config {
+        std::string device_topic;  // default: <topic base>config
+        std::string group_topic;   // none by default
+    };
+
+    static ConfigSync* GetInstance();
+
+    const Config& GetConfig() { return config_; }
+
+    // `activate` is set when the document asks for a staged profile to be activated
+    // (the caller must then restart).
+    esp_err_t Apply(Source source,
+                    const char* data,
+                    size_t length,
+                    bool* activate = nullptr,
+                    const char** error = nullptr);
+    uint32_t Version(Source source);
+
+   private:
+    static ConfigSync* instance_;
+    static SemaphoreHandle_t semaphore_;
+
+    ConfigSync();
+    ConfigSync(ConfigSync const&) = delete;
+    void operator=(ConfigSync const&) = delete;
+
+    esp_err_t SaveVersion(Source source, uint32_t version);
+
+    Config config_;
+    std::set<std::pair<std::string, std::string>> device_keys_;
+    bool device_seen_ = false;
+};
@@ -32,6 +32,7 @@ class Updater {
    public:
     static Updater* GetInstance();
     esp_err_t Update(const char* url);
+    esp_err_t UpdateConfigBundle(const char* url, const char* label = "config");
     bool PendingVerification();
     void Commit() { esp_ota_mark_app_valid_cancel_rollback(); }
     void Rollback() { esp_ota_mark_app_invalid_rollback_and_reboot(); }
@@ -2,20 +2,162 @@
 
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
 #include <mqtt_client.h>
 
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
-#include "status_led.hpp"
+#include "reassembler.hpp"
+#include "topic_trie.hpp"
+
+class StatusLed;  // status_led is not available on the linux target
 
 class MQTT {
    public:
     using LastWill = esp_mqtt_client_config_t::session_t::last_will_t;
+
+    // Result of an asynchronous publish: ESP_OK once the broker acknowledged the
+    // message (QoS 1/2) or the client accepted it (QoS 0), ESP_ERR_TIMEOUT if no
+    // acknowledgement came within the timeout, ESP_FAIL if the message was dropped
+    // (offline queue full, rejected, or deleted from the client outbox).
+    using PublishCallback = std::function<void(esp_err_t result)>;
+    static constexpr int kPublishTimeoutMs = 10000;
+
+    // Result of a request: ESP_OK and the response payload (only valid during the
+    // call), ESP_ERR_TIMEOUT, or the error of the request publish.
+    using ResponseCallback = std::function<void(esp_err_t result, std::string_view payload)>;
+    // Builds a request payload that carries the response topic (MQTT 3.1.1)
+    using RequestBuilder = std::function<std::string(const std::string& response_topic)>;
+    static constexpr int kRequestTimeoutMs = 5000;
+
+    // What to do with a message published while the offline queue is full
+    enum class DropPolicy {
+        kDropOldest,  // evict the oldest queued messages
+        kDropNewest,  // reject the new message
+        kCoalesce,    // replace the queued message with the same topic (else drop oldest)
+    };
+
+    // Connection state. Reconnects are scheduled by MQTT, with exponential
+    // backoff and jitter, instead of the fixed esp-mqtt reconnect timeout (kept as a
+    // fallback).
+    enum class State {
+        kStopped,
+        kConnecting,
+        kConnected,
+        kBackoff,  // waiting before the next attempt
+    };
+    using StateCallback = std::function<void(State from, State to)>;
+
+    struct Metrics {
+        uint32_t connects = 0;
+        uint32_t disconnects = 0;      // after being connected
+        uint32_t failed_attempts = 0;  // attempts that did not connect
+        uint32_t transport_errors = 0;
+        uint32_t refused = 0;  // CONNACK with an error code
+        int last_errno = 0;
+        int last_refused_code = 0;
+        int64_t last_connect_latency_ms = -1;  // from the start of the attempt to CONNACK
+        int64_t connected_ms = 0;              // total, including the current connection
+        uint32_t backoff_ms = 0;               // last backoff delay
+        uint32_t failovers = 0;                // connections to another broker than the last
+        int64_t last_failover_ms = -1;         // from losing the broker to connecting another
+        int broker = 0;                        // index in the broker list
+    };
+
+    // Publish side statistics, see GetPublishMetrics()
+    struct PublishMetrics {
+        // Upper bounds of the acknowledgement latency buckets; the last bucket
+        // counts the slower acknowledgements
+        static constexpr uint32_t kAckLatencyBoundsMs[] = {
+            10, 25, 50, 100, 250, 500, 1000, 2500, 5000};
+        static constexpr int kAckLatencyBuckets =
+            sizeof(kAckLatencyBoundsMs) / sizeof(kAckLatencyBoundsMs[0]) + 1;
+
+        uint32_t ack_latency[kAckLatencyBuckets] = {};  // QoS 1/2, publish to PUBACK/PUBCOMP
+        uint32_t ack_latency_max_ms = 0;
+        uint32_t published = 0;  // accepted by the client
+        uint32_t acked = 0;
+        uint32_t in_flight = 0;  // QoS 1/2, waiting for the acknowledgement
+        // Estimated from the acknowledgement latency: esp-mqtt resends an
+        // unacknowledged message every kRetransmitTimeoutMs without reporting it
+        uint32_t retransmits_estimated = 0;
+        uint32_t expired = 0;    // deleted from the client outbox
+        uint32_t timed_out = 0;  // not acknowledged within the publish timeout
+        uint32_t dropped = 0;    // by the offline queue
+        uint32_t queued = 0;     // in the offline queue
+        int outbox_bytes = 0;    // esp_mqtt_client_get_outbox_size()
+        uint64_t bytes_out = 0;  // topics and payloads
+        uint64_t bytes_in = 0;
+        uint32_t messages_in = 0;
+        uint64_t topic_bytes_saved = 0;  // by MQTT 5 topic aliases
+    };
+    static constexpr int kRetransmitTimeoutMs = 1000;
+
+    // Interned topic, see RegisterTopic()
+    struct TopicHandle {
+        int index = -1;
+        bool Valid() const { return index >= 0; }
+    };
+
+    struct InboundMetrics {
+        uint32_t received = 0;  // passed to the workers
+        uint32_t processed = 0;
+        uint32_t dropped = 0;  // queue full, or out of memory
+        uint32_t depth = 0;    // messages queued
+        uint32_t max_depth = 0;
+        size_t bytes = 0;  // queued
+    };
+
+    // MQTT 5 message properties, see PublishAsync() and MessageProperties()
+    struct Properties {
+        std::string response_topic;
+        std::string correlation_data;
+        std::string content_type;
+        uint32_t message_expiry_interval = 0;  // seconds, 0: does not expire
+        std::vector<std::pair<std::string, std::string>> user_properties;
+    };
+
+    // Applied to the topics matching a filter, see SetPublishPolicy()
+    struct PublishPolicy {
+        bool on_change = false;        // suppress payloads identical to the last one sent
+        uint32_t min_interval_ms = 0;  // suppress publishes closer than this to the last one
+        uint32_t heartbeat = 0;        // send an unchanged payload after this many suppressions
+    };
+
+    struct Config {
+        std::string topic_base = "esp/";
+        std::string broker;
+        std::string brokers;  // comma separated, in order of preference; overrides `broker`
+        std::string username;
+        std::string password;
+        // With a persistent session, the broker keeps the subscriptions (and QoS 1/2
+        // messages) while the device is away. The client id must then be stable:
+        // esp-mqtt's default is derived from the MAC address.
+        std::string client_id;
+        uint8_t persistent_session = 0;
+        uint8_t protocol_v5 = 0;  // requires CONFIG_MQTT_PROTOCOL_5
+        uint32_t startup_jitter_ms = 0;
+    };
+
     static MQTT* GetInstance();
-    void AddSubscription(const char* topic, int qos = 1);
+    // `handler` receives the messages matching the filter `topic`. With `prefixed`,
+    // `topic` is relative to the topic base and follows SetTopicBase(). Register
+    // subscriptions before Start().
+    void AddSubscription(const char* topic,
+                         int qos = 1,
+                         TopicTrie::Handler handler = nullptr,
+                         bool prefixed = false);
     void SetLed(StatusLed* led) { led_ = led; }
     esp_err_t Init(LastWill* last_will = nullptr, int keep_alive = 120);
     esp_err_t Start();
@@ -24,18 +166,204 @@ class MQTT {
                                    esp_event_handler_t event_handler,
                                    void* event_handler_arg);
 
-    std::string Prefixed(const char* topic) { return topic_base_ + topic; }
+    std::string Prefixed(const char* topic);
+    std::string TopicBase();
+
+    // The delay before attempt n is drawn from [d/2, d], d = min(min_ms * 2^n, max_ms).
+    // Call before Init().
+    void SetBackoff(uint32_t min_ms, uint32_t max_ms);
+    // Delays the first connection, and the first reconnect after losing the
+    // broker, by a per-device offset in [0, window_ms) derived from the MAC
+    // address (mqtt:startup-jitter-ms). Call before Init().
+    void SetStartupJitter(uint32_t window_ms);
+    uint32_t StartupDelayMs();
+    // Callbacks run on the task that changes the state: the MQTT task, the caller of
+    // Start(), or the esp_timer task after a startup delay. Register them before Start().
+    void OnStateChange(StateCallback callback) { state_callbacks_.push_back(callback); }
+    State GetState();
+    bool IsConnected();
+    static const char* StateName(State state);
+    Metrics GetMetrics();
+    PublishMetrics GetPublishMetrics();
+
+    // Switches to the next broker after `attempts` failed connection attempts, and
+    // probes the first broker every `probe_interval_sec` while using another one.
+    void SetFailover(int attempts, int probe_interval_sec);
+    const std::string& CurrentBroker() { return brokers_[broker_]; }
+
+    // Builds the full topic once; publishing with the handle does not allocate.
+    // Prefixed topics are rebuilt by SetTopicBase().
+    TopicHandle RegisterTopic(const char* topic, bool prefixed = true);
+    std::shared_ptr<const std::string> TopicName(TopicHandle topic);
+    // Rebuilds the prefixed topics and moves the prefixed subscriptions. Called
+    // when mqtt:topic-base changes in the running configuration.
+    void SetTopicBase(const char* topic_base);
+
+    // Messages published while disconnected are queued (payloads in PSRAM when
+    // available) and sent in order, paced, once connected again.
     esp_err_t Publish(const char* topic, const char* data, int len, int qos = 1, int retain = 0);
+    esp_err_t Publish(TopicHandle topic, const char* data, int len, int qos = 1, int retain = 0);
+    void SetQueueLimits(size_t max_messages, size_t max_bytes);
+    void SetDropPolicy(const char* filter, DropPolicy policy);
+    void SetDrainPacing(int burst, int interval_ms);
+    // After connecting, waits a random delay in [0, window_ms) before resubscribing
+    // and draining the offline queue (1 s by default, 0 to disable).
+    void SetResumeJitter(uint32_t window_ms);
+
+    // The first matching filter applies. A suppressed publish returns ESP_OK (and
+    // PublishAsync calls `done` with ESP_OK): the broker already has the value. A
+    // changed value within `min_interval_ms` is held back and sent at the end of the
+    // interval, unless a newer value replaces it; only values handed to the client or
+    // queued count as published.
+    void SetPublishPolicy(const char* filter, PublishPolicy policy);
+    uint32_t SuppressedMessages() { return suppressed_; }
+
+    // Never waits for the network: the message goes to the client outbox, or to
+    // the offline queue while disconnected. `done` runs once, and only if ESP_OK
+    // is returned, on the task that settles the message: the caller's (QoS 0,
+    // suppressed, or evicted from the queue), the MQTT task (acknowledged or
+    // deleted), the drain task, or the esp_timer task (timeout). Keep it short.
+    esp_err_t PublishAsync(const char* topic,
+                           const char* data,
+                           int len,
+                           int qos = 1,
+                           int retain = 0,
+                           PublishCallback done = nullptr,
+                           int timeout_ms = kPublishTimeoutMs);
+    esp_err_t PublishAsync(TopicHandle topic,
+                           const char* data,
+                           int len,
+                           int qos = 1,
+                           int retain = 0,
+                           PublishCallback done = nullptr,
+                           int timeout_ms = kPublishTimeoutMs);
+
+    // Properties are only sent with MQTT 5
+    esp_err_t PublishAsync(const char* topic,
+                           const char* data,
+                           int len,
+                           int qos,
+                           int retain,
+                           const Properties& properties,
+                           PublishCallback done = nullptr,
+                           int timeout_ms = kPublishTimeoutMs);
+
+    // With MQTT 5, topics published at least `min_publishes` times at QoS 0 get one
+    // of `max_aliases` topic aliases (fewer if the broker allows less), and QoS 0
+    // messages to them are then sent without the topic. QoS 1/2 messages always
+    // carry the full topic and no alias.
+    void SetTopicAliases(int max_aliases, int min_publishes);
+    bool ProtocolV5() { return v5_; }
+    // Properties of the message being dispatched, only valid in a handler; false
+    // with MQTT 3.1.1 and for reassembled messages.
+    bool MessageProperties(Properties* properties);
+
+    // Subscription handlers run on `workers` tasks instead of the MQTT task, so
+    // that a slow handler does not delay the keepalives. The messages of a topic
+    // are handled in order, always by the same worker; handlers of different
+    // topics may run concurrently. Incoming messages are dropped while
+    // `max_messages` or `max_bytes` are queued. Call before Init().
+    void SetInboundWorkers(int workers,
+                           size_t max_messages = 32,
+                           size_t max_bytes = 16 * 1024,
+                           uint32_t stack_size = 4096,
+                           UBaseType_t priority = 5);
+    InboundMetrics GetInboundMetrics();
 
-    std::string topic_base_ = "esp/";
+    // Request/response: each request gets its own response topic,
+    // "<topic-base><prefix><id>", also sent as the MQTT 5 response topic with the
+    // id as correlation data. Call before Start(); `max_pending` bounds the
+    // requests in flight.
+    void EnableRequests(const char* prefix = "response/", size_t max_pending = 32);
+    // `done` runs once: where subscription handlers run for responses, on the
+    // esp_timer task for timeouts, at the deadline (a one-shot timer armed for the
+    // earliest one). Publish policies do not apply to requests. Call after Init().
+    esp_err_t Request(const char* topic,
+                      const char* data,
+                      int len,
+                      ResponseCallback done,
+                      int timeout_ms = kRequestTimeoutMs);
+    // For services without MQTT 5, the payload names the response topic
+    esp_err_t Request(const char* topic,
+                      RequestBuilder build,
+                      ResponseCallback done,
+                      int timeout_ms = kRequestTimeoutMs);
+    size_t PendingRequests();
+
+    size_t QueuedMessages();
+    uint32_t DroppedMessages() { return dropped_; }
+
+    // Messages larger than the client buffer arrive in fragments; they are
+    // reassembled in one of `buffers` pooled buffers (allocated on the first
+    // fragmented message) and dropped above `max_message_size`. Fails with
+    // ESP_ERR_INVALID_STATE once the buffers are allocated.
+    esp_err_t SetReassembly(size_t buffers, size_t max_message_size);
+    uint32_t OversizedMessages() { return reassembler_.Oversized(); }
 
     bool fatal_error_ = false;
-    bool connected_ = false;
 
    private:
     struct subscription {
         std::string topic;
         int qos;
+        bool prefixed;  // `topic` is relative to the topic base
+    };
+
+    struct QueuedMessage {
+        std::string topic;
+        std::shared_ptr<char> data;
+        int len;
+        int qos;
+        int retain;
+        PublishCallback done;
+        int timeout_ms;
+        std::shared_ptr<const Properties> properties;  // may be nullptr
+        bool sending = false;  // by the drain task: neither coalesced nor evicted
+    };
+
+    struct InternedTopic {
+        std::string topic;
+        bool prefixed;
+        std::shared_ptr<const std::string> full;  // replaced, never modified
+    };
+
+    struct TopicState {
+        uint32_t hash = 0;
+        int64_t last_publish = 0;  // esp_timer_get_time()
+        uint32_t suppressed = 0;   // since the last publish
+        // Latest value held back by the minimum interval, sent at `held_until`
+        std::shared_ptr<QueuedMessage> held;
+        int64_t held_until = 0;
+    };
+
+    struct TopicAlias {
+        uint32_t publishes;
+        uint16_t alias;  // 0: none
+        bool announced;  // sent with the topic on this connection
+    };
+
+    struct InboundMessage {
+        std::string topic;
+        std::shared_ptr<char> data;
+        int len;
+        std::shared_ptr<const Properties> properties;  // may be nullptr
+    };
+
+    struct InboundWorker {
+        MQTT* mqtt;
+        TaskHandle_t task;
+        std::deque<InboundMessage> queue;  // guarded by inbound_mutex_
+    };
+
+    struct PendingRequest {
+        ResponseCallback done;
+        int64_t deadline;  // esp_timer_get_time()
+    };
+
+    struct PendingAck {
+        PublishCallback done;  // may be nullptr
+        int64_t sent;          // esp_timer_get_time()
+        int64_t deadline;      // esp_timer_get_time()
     };
 
     static MQTT* instance_;
@@ -57,7 +385,205 @@ class MQTT {
         instance->EventHandler(event_base, event_id, event_data);
     }
 
+    // Outcome of the publish policies for one message, see Suppress()
+    struct PolicyCheck {
+        bool suppress = false;  // suppressed, or held back by the minimum interval
+        bool tracked = false;   // a policy applies: record it with Published()
+        uint32_t hash = 0;
+    };
+    PolicyCheck Suppress(const char* topic,
+                         const char* data,
+                         int len,
+                         int qos,
+                         int retain,
+                         std::shared_ptr<const Properties> properties);
+    void Published(const char* topic, const PolicyCheck& check);
+    static void ArmOnce(esp_timer_handle_t timer, int64_t* armed, int64_t due);
+    void SendTrailing();
+    static void TrailingTimerForwarder(void* arg) {
+        MQTT* instance = static_cast<MQTT*>(arg);
+        instance->SendTrailing();
+    }
+
+    // `policies`: apply the publish policies (not to requests)
+    esp_err_t Submit(const char* topic,
+                     const char* data,
+                     int len,
+                     int qos,
+                     int retain,
+                     std::shared_ptr<const Properties> properties,
+                     PublishCallback done,
+                     int timeout_ms,
+                     bool policies = true);
+    int Send(const char* topic,
+             const char* data,
+             int len,
+             int qos,
+             int retain,
+             const Properties* properties,
+             bool enqueue,
+             size_t* bytes);
+    TopicAlias* AliasOf(const char* topic);
+    void ResetTopicAliases();
+    esp_err_t Enqueue(const char* topic,
+                      const char* data,
+                      int len,
+                      int qos,
+                      int retain,
+                      PublishCallback done = nullptr,
+                      int timeout_ms = 0,
+                      std::shared_ptr<const Properties> properties = nullptr);
+    DropPolicy PolicyOf(const char* topic);
+    static void DrainTaskForwarder(void* arg) {
+        MQTT* instance = static_cast<MQTT*>(arg);
+        instance->DrainTask();
+    }
+    void DrainTask();
+
+    void Reassemble(esp_mqtt_event_handle_t event);
+    void Deliver(std::string_view topic,
+                 std::string_view payload,
+                 std::shared_ptr<char> buffer,
+                 esp_mqtt_event_handle_t event = nullptr);
+    void Dispatch(std::string_view topic,
+                  std::string_view payload,
+                  esp_mqtt_event_handle_t event,
+                  const Properties* properties);
+    static bool ReadProperties(esp_mqtt_event_handle_t event, Properties* properties);
+    void StartInboundWorkers();
+    static void InboundWorkerForwarder(void* arg) {
+        InboundWorker* worker = static_cast<InboundWorker*>(arg);
+        worker->mqtt->InboundTask(worker);
+    }
+    void InboundTask(InboundWorker* worker);
+
+    void Subscribe(bool session_present);
+    void ConfigChanged(const char* name_space, const char* key);
+
+    void SelectBroker(int broker);
+    void SaveLastGoodBroker();
+    static void ProbeTimerForwarder(void* arg);
+    static void ProbeTask(void* arg);
+
+    esp_err_t StartClient();
+    static void StartTimerForwarder(void* arg) {
+        MQTT* instance = static_cast<MQTT*>(arg);
+        instance->StartClient();
+    }
+
+    void SetState(State state);
+    void ScheduleReconnect();
+    static void ReconnectTimerForwarder(void* arg);
+
+    void TrackAck(int msg_id, size_t bytes, int qos, PublishCallback done, int timeout_ms);
+    void RecordAck(int64_t latency_us);
+    void Acknowledge(int msg_id, esp_err_t result);
+    static void AckTimerForwarder(void* arg) {
+        MQTT* instance = static_cast<MQTT*>(arg);
+        instance->ExpireAcks();
+    }
+    void ExpireAcks();
+
+    uint32_t NextRequestId();
+    std::string ResponseTopic(uint32_t id);
+    esp_err_t SendRequest(uint32_t id,
+                          const char* topic,
+                          const char* data,
+                          int len,
+                          ResponseCallback done,
+                          int timeout_ms);
+    void HandleResponse(std::string_view topic, std::string_view payload);
+    void CompleteRequest(uint32_t id, esp_err_t result, std::string_view payload);
+    void ExpireRequests();
+    static void RequestTimerForwarder(void* arg) {
+        MQTT* instance = static_cast<MQTT*>(arg);
+        instance->ExpireRequests();
+    }
+
     StatusLed* led_ = nullptr;
-    esp_mqtt_client_handle_t client_;
-    std::vector<subscription> subscriptions_;
+    Config config_;
+    esp_mqtt_client_handle_t client_ = nullptr;
+    std::vector<subscription> subscriptions_;  // guarded by topics_mutex_
+    bool subscribed_ = false;  // at least once since boot, guarded by topics_mutex_
+
+    SemaphoreHandle_t state_mutex_;
+    State state_ = State::kStopped;
+    std::vector<StateCallback> state_callbacks_;
+    Metrics metrics_;
+    uint32_t attempt_ = 0;
+    int64_t attempt_start_ = 0;    // esp_timer_get_time()
+    int64_t connected_since_ = 0;  // esp_timer_get_time()
+    uint32_t backoff_min_ms_ = 1000;
+    uint32_t backoff_max_ms_ = 120000;
+    esp_timer_handle_t reconnect_timer_ = nullptr;
+    esp_timer_handle_t start_timer_ = nullptr;
+
+    std::vector<std::string> brokers_;
+    int broker_ = 0;
+    int good_broker_ = 0;          // last broker connected to
+    int broker_failures_ = 0;      // consecutive failed attempts on `broker_`
+    int64_t lost_at_ = 0;          // esp_timer_get_time() when the last broker was lost
+    int failover_attempts_ = 3;
+    int probe_interval_sec_ = 600;
+    esp_timer_handle_t probe_timer_ = nullptr;
+    bool probing_ = false;   // guarded by state_mutex_
+    bool failback_ = false;  // guarded by state_mutex_, applied by ScheduleReconnect()
+    TopicTrie handlers_;
+    TopicTrie prefixed_handlers_;  // filters relative to the topic base
+
+    SemaphoreHandle_t topics_mutex_;
+    std::string topic_base_ = "esp/";  // guarded by topics_mutex_
+    std::vector<InternedTopic> topics_;
+    std::vector<std::pair<std::string, PublishPolicy>> publish_policies_;
+    std::map<std::string, TopicState, std::less<>> topic_states_;  // guarded by topics_mutex_
+    uint32_t suppressed_ = 0;
+    esp_timer_handle_t trailing_timer_ = nullptr;
+    int64_t trailing_due_ = 0;  // see ArmOnce(), guarded by topics_mutex_
+
+    bool v5_ = false;
+    SemaphoreHandle_t v5_mutex_;  // publish properties are set before each publish
+    std::map<std::string, TopicAlias, std::less<>> aliases_;  // guarded by v5_mutex_
+    int max_aliases_ = 16;
+    int alias_min_publishes_ = 2;
+    int alias_limit_ = 16;  // lowered if the broker rejects an alias
+    int next_alias_ = 1;
+    uint64_t topic_bytes_saved_ = 0;
+
+    SemaphoreHandle_t inbound_mutex_;
+    std::vector<std::unique_ptr<InboundWorker>> inbound_workers_;  // none: on the MQTT task
+    int inbound_worker_count_ = 0;
+    size_t inbound_max_messages_ = 32;
+    size_t inbound_max_bytes_ = 16 * 1024;
+    uint32_t inbound_stack_size_ = 4096;
+    UBaseType_t inbound_priority_ = 5;
+    InboundMetrics inbound_metrics_;  // guarded by inbound_mutex_
+
+    Reassembler reassembler_;  // MQTT task only
+
+    SemaphoreHandle_t queue_mutex_;
+    std::deque<QueuedMessage> queue_;
+    size_t queue_bytes_ = 0;
+    size_t max_messages_ = 256;
+    size_t max_bytes_ = 64 * 1024;
+    std::vector<std::pair<std::string, DropPolicy>> policies_;
+    uint32_t dropped_ = 0;
+    bool draining_ = false;
+    TaskHandle_t drain_task_ = nullptr;
+    int drain_burst_ = 10;
+    int drain_interval_ms_ = 50;
+    uint32_t resume_jitter_ms_ = 1000;
+    bool session_present_ = false;  // of the last connection, guarded by queue_mutex_
+
+    std::map<int, PendingAck> pending_acks_;  // by msg_id, guarded by queue_mutex_
+    std::deque<int> early_acks_;  // acknowledged before TrackAck() saw their msg_id
+    PublishMetrics publish_metrics_;  // guarded by queue_mutex_
+    esp_timer_handle_t ack_timer_ = nullptr;
+
+    SemaphoreHandle_t requests_mutex_;
+    std::string response_prefix_;  // below the topic base; empty until EnableRequests()
+    size_t max_pending_requests_ = 32;
+    uint32_t next_request_id_ = 0;
+    std::unordered_map<uint32_t, PendingRequest> requests_;  // guarded by requests_mutex_
+    esp_timer_handle_t request_timer_ = nullptr;
+    int64_t request_due_ = 0;  // see ArmOnce(), guarded by requests_mutex_
 };
@@ -14,13 +14,38 @@
 
 #pragma once
 
+#include <cJSON.h>
 #include <nvs.h>
 
+#include <functional>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <vector>
+
 class NvsHandle {
    public:
+    static constexpr const char* kAppPartition = "nvs_app";
+
     NvsHandle();
     ~NvsHandle();
 
+    // Namespaces can be routed to another NVS partition (e.g. kAppPartition) to keep
+    // heavy application writes away from the partition shared with Wi-Fi and
+    // provisioning. Routes must be set up before the namespace is first opened.
+    static esp_err_t InitPartition(const char* partition);
+    static void RouteNameSpace(const char* name_space, const char* partition);
+    static const char* PartitionOf(const char* name_space);
+    static const std::vector<std::string>& Partitions() { return partitions_; }
+
+    // A namespace can be an alias of another (physical) namespace: Open() then reads
+    // the target, while bundle lookups keep using the logical name. ConfigProfiles uses
+    // this to select the active slot. Hidden namespaces are not reported by GetAll.
+    static void AliasNameSpace(const char* name_space, const char* target);
+    static void HideNameSpace(const char* name_space);
+    static const char* LogicalNameSpace(const char* physical);
+    static const char* PhysicalNameSpace(const char* name_space);
+
     static esp_err_t TypeOf(const char* type, nvs_type_t* nvs_type);
     static esp_err_t TypeName(nvs_type_t type, char* name, size_t size);
 
@@ -28,12 +53,14 @@ class NvsHandle {
     static int Base64Decode(char* dst, size_t dlen, size_t* olen, const char* src, size_t slen);
 
     esp_err_t Open(const char* name_space, nvs_open_mode_t mode);
+    esp_err_t Open(const char* name_space, nvs_open_mode_t mode, const char* partition);
     void Close();
 
     esp_err_t FindKey(const char* key, nvs_type_t* out_type);
 
     esp_err_t GetInt(const char* key, nvs_type_t type, double* value);
     esp_err_t GetString(const char* key, char* value, size_t* length);
+    esp_err_t GetString(const char* key, std::string* value);
     esp_err_t GetBlob(const char* key, void* value, size_t* length);
 
     esp_err_t SetInt(const char* key, nvs_type_t type, double value);
@@ -46,9 +73,131 @@ class NvsHandle {
     esp_err_t EraseAll();
 
    private:
+    static std::vector<std::string> partitions_;
+    static std::map<std::string, std::string> routes_;
+    static std::map<std::string, std::string> aliases_;
+    static std::vector<std::string> hidden_;
+
+    esp_err_t GetFromBundle(const char* key, nvs_type_t type, void* value, size_t* length);
+
     nvs_handle_t handle_;
+    char name_space_[NVS_NS_NAME_MAX_SIZE];  // logical, for bundle lookups
+    char physical_[NVS_NS_NAME_MAX_SIZE];    // opened, for ConfigHash
+};
+
+// Declarative binding of the fields of a struct to the keys of a namespace. Load()
+// opens the namespace once and reads every bound key; keys missing from NVS (and
+// from the configuration bundle) leave the field at its default value.
+//
+//   static const NvsBinding<Config> binding = NvsBinding<Config>("mqtt")
+//       .Bind("broker", &Config::broker)
+//       .Bind("port", &Config::port);
+//   binding.Load(&config);
+template <typename T>
+class NvsBinding {
+   public:
+    explicit NvsBinding(const char* name_space) : name_space_(name_space) {}
+
+    NvsBinding& Bind(const char* key, std::string T::*member) {
+        auto load = [member](NvsHandle& handle, const char* key, T* object) {
+            return handle.GetString(key, &(object->*member));
+        };
+        fields_.push_back({key, load});
+        return *this;
+    }
+
+    template <typename I, typename = std::enable_if_t<std::is_integral_v<I>>>
+    NvsBinding& Bind(const char* key, I T::*member) {
+        auto load = [member](NvsHandle& handle, const char* key, T* object) {
+            double value;
+            esp_err_t err = handle.GetInt(key, TypeOf<I>(), &value);
+            if (err == ESP_OK) {
+                object->*member = (I)value;
+            }
+            return err;
+        };
+        fields_.push_back({key, load});
+        return *this;
+    }
+
+    // Returns the number of fields found, or a negative value if a key could not be read
+    int Load(T* object) const {
+        NvsHandle handle;
+        handle.Open(name_space_, NVS_READONLY);  // missing namespace: bundle only
+        int found = 0;
+        for (auto& field : fields_) {
+            esp_err_t err = field.load(handle, field.key, object);
+            if (err == ESP_OK) {
+                found++;
+            } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+                return -1;
+            }
+        }
+        return found;
+    }
+
+    const char* NameSpace() const { return name_space_; }
+
+   private:
+    struct Field {
+        const char* key;
+        std::function<esp_err_t(NvsHandle&, const char*, T*)> load;
+    };
+
+    template <typename I>
+    static constexpr nvs_type_t TypeOf() {
+        if constexpr (sizeof(I) == 1) {
+            return std::is_signed_v<I> ? NVS_TYPE_I8 : NVS_TYPE_U8;
+        } else if constexpr (sizeof(I) == 2) {
+            return std::is_signed_v<I> ? NVS_TYPE_I16 : NVS_TYPE_U16;
+        } else if constexpr (sizeof(I) == 4) {
+            return std::is_signed_v<I> ? NVS_TYPE_I32 : NVS_TYPE_U32;
+        } else {
+            return std::is_signed_v<I> ? NVS_TYPE_I64 : NVS_TYPE_U64;
+        }
+    }
+
+    const char* name_space_;
+    std::vector<Field> fields_;
 };
 
 class NvsConfig {
    public:
+    // Transport independent configuration services. On failure, `error` (when not null)
+    // receives a static, human readable message suitable for an HTTP or MQTT reply.
+    static esp_err_t SetKey(const char* name_space,
+                            const char* key,
+                            const cJSON* node,
+                            const char** error = nullptr);
+    static esp_err_t GetKey(const char* name_space,
+                            const char* key,
+                            cJSON* node,
+                            const char** error = nullptr);
+    static esp_err_t GetAll(cJSON* node, const char** error = nullptr);
+    static esp_err_t DeleteKey(const char* name_space,
+                               const char* key,
+                               const char** error = nullptr);
+    static esp_err_t DeleteNameSpace(const char* name_space, const char** error = nullptr);
+
+    // `request` maps namespaces to the client's hash, either as a string or as
+    // {"hash": ..., "keys": {key: hash}}. `node` receives the namespaces whose hash
+    // differs, with the device's hash of each differing key (null if missing).
+    static esp_err_t Diff(const cJSON* request, cJSON* node, const char** error = nullptr);
+
+    static esp_err_t ToJson(NvsHandle& handle,
+                            const char* key,
+                            nvs_type_t nvs_type,
+                            cJSON* node,
+                            const char** error = nullptr);
+
+    // Called, on the writing task, after SetKey, DeleteKey or DeleteNameSpace
+    // changed the running configuration (`key` is nullptr for a whole namespace).
+    // Writes staged in a configuration profile only apply once it is activated,
+    // and are not reported. Register callbacks at initialization.
+    using ChangeCallback = std::function<void(const char* name_space, const char* key)>;
+    static void OnChange(ChangeCallback callback) { change_callbacks_.push_back(callback); }
+
+   private:
+    static void Changed(const char* name_space, const char* key);
+    static std::vector<ChangeCallback> change_callbacks_;
 };
@@ -0,0 +1,88 @@
+/**
+ ******************************************************************************
+ * @file        : persistent_counters.hpp
+ * @brief       : Persistent Counters
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Counters kept in RTC slow memory, which survives software
+ *                resets, panics and watchdog resets, and protected by a CRC.
+ *                Updating a counter does not touch the flash: the counters are
+ *                written to NVS (namespace "counters") on a schedule and on
+ *                esp_restart(), and restored from NVS when the RTC memory is
+ *                not valid (power loss).
+ *
+ *                Built-in counters: "boots", "crashes" (panic, watchdog and
+ *                brownout resets), "uptime-s" (total), "boot-uptime-s" (this
+ *                boot) and "last-uptime-s" (previous boot).
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <nvs.h>
+
+#include <functional>
+
+class PersistentCounters {
+   public:
+    static constexpr int kMaxCounters = 16;
+    static constexpr const char* kNameSpace = "counters";
+
+    static PersistentCounters* GetInstance();
+
+    esp_err_t Init(int checkpoint_sec = 15 * 60);
+
+    // Counters are created on first use. Names are NVS keys (at most 15 characters).
+    esp_err_t Add(const char* name, uint64_t delta = 1);
+    esp_err_t Set(const char* name, uint64_t value);
+    uint64_t Get(const char* name);
+    void ForEach(std::function<void(const char* name, uint64_t value)> callback);
+
+    esp_err_t Checkpoint();
+
+   private:
+    static constexpr uint32_t kMagic = 0x52544343;  // "CCTR"
+
+    struct Counter {
+        char name[NVS_KEY_NAME_MAX_SIZE];
+        uint64_t value;
+        uint64_t checkpointed;  // value in NVS
+    };
+
+    struct Block {
+        uint32_t magic;
+        uint32_t count;
+        Counter counters[kMaxCounters];
+        uint32_t crc;
+    };
+
+    static PersistentCounters* instance_;
+    static SemaphoreHandle_t semaphore_;
+    static Block block_;
+
+    PersistentCounters(){};
+    PersistentCounters(PersistentCounters const&) = delete;
+    void operator=(PersistentCounters const&) = delete;
+
+    static uint32_t Crc();
+    static void Seal() { block_.crc = Crc(); }
+    static void ShutdownHandler();
+    static void TickForwarder(void* arg) { static_cast<PersistentCounters*>(arg)->Tick(); }
+
+    Counter* Find(const char* name, bool create);
+    esp_err_t Restore();
+    void Tick();
+
+    esp_timer_handle_t timer_ = nullptr;
+    uint64_t uptime_at_boot_ = 0;
+    int ticks_ = 0;
+    int ticks_per_checkpoint_ = 0;
+};
@@ -0,0 +1,54 @@
+/**
+ ******************************************************************************
+ * @file        : reassembler.hpp
+ * @brief       : MQTT Message Reassembler
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Reassembles messages larger than the MQTT client buffer.
+ *                esp-mqtt delivers the fragments of a message in order and
+ *                without interleaving other messages; only the first one
+ *                carries the topic. Messages are copied into one of a few
+ *                pooled buffers, allocated on the first fragmented message.
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <esp_err.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "buffer_pool.hpp"
+
+class Reassembler {
+   public:
+    // Fails with ESP_ERR_INVALID_STATE once the buffers are allocated
+    esp_err_t Configure(size_t buffers, size_t max_message_size);
+
+    // Adds the fragment at `offset` of a `total` bytes message. Returns true when
+    // it completes the message, which is then in `message` (`total` bytes) and
+    // was published on Topic(). Messages that do not fit are dropped.
+    bool Add(std::string_view topic,
+             const char* data,
+             int len,
+             int offset,
+             int total,
+             std::shared_ptr<char>* message);
+    const std::string& Topic() const { return topic_; }
+    uint32_t Oversized() const { return oversized_; }
+
+   private:
+    BufferPool pool_;
+    size_t buffers_ = 2;
+    size_t max_message_size_ = 16 * 1024;
+    std::string topic_;
+    std::shared_ptr<char> buffer_;  // nullptr: no message being reassembled
+    int received_ = 0;
+    uint32_t oversized_ = 0;
+};
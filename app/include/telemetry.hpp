@@ -0,0 +1,84 @@
+/**
+ ******************************************************************************
+ * @file        : telemetry.hpp
+ * @brief       : Batched Telemetry Publisher
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Samples of registered channels are accumulated in a
+ *                TelemetryBatch and published as one MQTT message on
+ *                "<topic-base><topic>" when the batch reaches its size limit
+ *                or when the flush interval elapses. The channel list is
+ *                published, retained, on "<topic-base><topic>/schema":
+ *
+ *                  {"version": 1, "channels": [{"name": "temp", "decimals": 1}]}
+ *
+ *                The channel id is the index in this list. A value is sent as
+ *                round(value * 10^decimals).
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <string>
+#include <vector>
+
+#include "mqtt.hpp"
+#include "telemetry_batch.hpp"
+
+class Telemetry {
+   public:
+    static Telemetry* GetInstance();
+
+    // Returns the channel id, or -1. Register all channels before Start().
+    int AddChannel(const char* name, int decimals = 0);
+    esp_err_t Start(const char* topic = "telemetry",
+                    size_t max_batch_bytes = 1024,
+                    int flush_interval_ms = 5000,
+                    int qos = 0);
+
+    esp_err_t Record(int channel, double value);
+    esp_err_t Flush();
+
+    uint32_t Samples() { return samples_; }
+    uint32_t Batches() { return batches_; }
+
+   private:
+    struct Channel {
+        std::string name;
+        int decimals;
+        double scale;
+    };
+
+    static Telemetry* instance_;
+    static SemaphoreHandle_t semaphore_;
+
+    Telemetry();
+    Telemetry(Telemetry const&) = delete;
+    void operator=(Telemetry const&) = delete;
+
+    esp_err_t PublishSchema();
+    static void FlushTimerForwarder(void* arg) {
+        Telemetry* instance = static_cast<Telemetry*>(arg);
+        instance->Flush();
+    }
+
+    SemaphoreHandle_t mutex_;
+    std::vector<Channel> channels_;
+    TelemetryBatch batch_;
+    MQTT::TopicHandle topic_;
+    MQTT::TopicHandle schema_topic_;
+    size_t max_batch_bytes_ = 1024;
+    int qos_ = 0;
+    esp_timer_handle_t timer_ = nullptr;
+    uint32_t samples_ = 0;
+    uint32_t batches_ = 0;
+};
@@ -0,0 +1,54 @@
+/**
+ ******************************************************************************
+ * @file        : telemetry_batch.hpp
+ * @brief       : Compact Telemetry Batch Encoding
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : A batch is:
+ *
+ *                  'T', version (1), varint timestamp (ms) of the first sample
+ *                  then, for every sample until the end of the payload:
+ *                    varint channel, svarint timestamp delta (ms),
+ *                    svarint value delta
+ *
+ *                varints are unsigned LEB128; svarints are zigzag encoded
+ *                first. Timestamp deltas are relative to the previous sample
+ *                of the batch. Values are integers (the channel scales them,
+ *                see Telemetry), relative to the previous value of the same
+ *                channel in the batch, or to 0. tools/telemetry.py decodes it.
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+class TelemetryBatch {
+   public:
+    static constexpr uint8_t kMagic = 'T';
+    static constexpr uint8_t kVersion = 1;
+
+    void Reset();
+    void Add(uint32_t channel, int64_t timestamp_ms, int64_t value);
+
+    bool Empty() const { return samples_ == 0; }
+    size_t Samples() const { return samples_; }
+    size_t Size() const { return data_.size(); }
+    const std::vector<uint8_t>& Data() const { return data_; }
+
+   private:
+    void PutVarint(uint64_t value);
+    void PutSignedVarint(int64_t value) { PutVarint(((uint64_t)value << 1) ^ (value >> 63)); }
+
+    std::vector<uint8_t> data_;
+    std::vector<int64_t> last_values_;  // by channel
+    int64_t last_timestamp_ = 0;
+    size_t samples_ = 0;
+};
@@ -0,0 +1,64 @@
+/**
+ ******************************************************************************
+ * @file        : topic_trie.hpp
+ * @brief       : MQTT Topic Filter Trie
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : One node per topic level, with separate children for the `+`
+ *                and `#` wildcards. Matching a topic follows the literal, `+`
+ *                and `#` branches of every level, so its cost depends on the
+ *                number of levels, not on the number of filters. As in MQTT,
+ *                wildcards at the first level do not match topics starting
+ *                with `$`.
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class TopicTrie {
+   public:
+    // The views are only valid during the call
+    using Handler = std::function<void(std::string_view topic, std::string_view payload)>;
+
+    void Add(std::string_view filter, Handler handler);
+    // Calls the handlers of all matching filters and returns their number. The
+    // first `prefix` characters of the topic are not matched, but the handlers
+    // still receive the whole topic.
+    int Dispatch(std::string_view topic, std::string_view payload, size_t prefix = 0) const;
+    bool Empty() const { return root_.Empty(); }
+
+    // Matches a single filter, with the same rules as Dispatch
+    static bool Matches(std::string_view filter, std::string_view topic);
+
+   private:
+    struct Node {
+        std::map<std::string, std::unique_ptr<Node>, std::less<>> children;
+        std::unique_ptr<Node> plus;
+        std::vector<Handler> handlers;       // filters ending at this level
+        std::vector<Handler> hash_handlers;  // filters ending with "/#" at this level
+
+        bool Empty() const {
+            return children.empty() && plus == nullptr && handlers.empty() &&
+                   hash_handlers.empty();
+        }
+    };
+
+    static int Visit(const Node* node,
+                     std::string_view topic,
+                     std::string_view rest,
+                     bool first,
+                     std::string_view payload);
+
+    Node root_;
+};
@@ -16,6 +16,7 @@
 
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
@@ -25,9 +26,15 @@
 #include <wifi_provisioning/manager.h>
 
 #include <memory>
+#include <string_view>
 
 #include "cJSON.h"
+#include "config_bundle.hpp"
+#include "config_profiles.hpp"
+#include "config_sync.hpp"
 #include "driver/gpio.h"
+#include "nvs_config.hpp"
+#include "persistent_counters.hpp"
 #include "sdkconfig.h"
 #include "status_led.hpp"
 
@@ -36,6 +43,9 @@ static const char* kTag = "app";
 App* App::instance_ = nullptr;
 SemaphoreHandle_t App::semaphore_ = xSemaphoreCreateMutex();
 
+static const NvsBinding<App::Config> kConfigBinding =
+    NvsBinding<App::Config>("system").Bind("hostname", &App::Config::hostname);
+
 #if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
 
 static void* psram_malloc(size_t size) { return heap_caps_malloc(size, MALLOC_CAP_SPIRAM); }
@@ -59,6 +69,28 @@ App::App() {
         ESP_ERROR_CHECK(nvs_flash_init());
     }
 
+    // Initialize the application NVS partition (if the partition table has one)
+    err = NvsHandle::InitPartition(NvsHandle::kAppPartition);
+    if (err != ESP_OK) {
+        ESP_LOGI(kTag, "No application NVS partition: %s", esp_err_to_name(err));
+    }
+
+    // Boot and crash counters (checkpointed to the application partition)
+    NvsHandle::RouteNameSpace(PersistentCounters::kNameSpace, NvsHandle::kAppPartition);
+    counters_ = PersistentCounters::GetInstance();
+    counters_->Init();
+
+    // Map the fleet-wide configuration defaults (if the partition holds a bundle)
+    ConfigBundle::GetInstance()->Mount();
+
+    // Select the active configuration profile before any protected namespace is read
+    profiles_ = ConfigProfiles::GetInstance();
+    profiles_->Protect("mqtt");
+    err = profiles_->Init();
+    if (err != ESP_OK) {
+        ESP_LOGW(kTag, "Failed to initialize configuration profiles: %s", esp_err_to_name(err));
+    }
+
     // Initialize TCP/IP
     ESP_ERROR_CHECK(esp_netif_init());
 
@@ -69,22 +101,15 @@ App::App() {
     wifi_ = esp_netif_create_default_wifi_sta();
 
     // Get Hostname from NVS "system:hostname" (if available)
-    nvs_handle_t my_handle;
-    char hostname[32];
-    err = nvs_open("system", NVS_READWRITE, &my_handle);
-    if (err == ESP_OK) {
-        size_t size = sizeof(hostname);
-        err = nvs_get_str(my_handle, "hostname", hostname, &size);
-        if (err == ESP_OK) {
-            ESP_LOGI(kTag, "Hostname : %s", hostname);
-            err = esp_netif_set_hostname(wifi_, hostname);
-            if (err != ESP_OK) {
-                ESP_LOGW(kTag, "Failed to set hostname");
-            }
+    if (kConfigBinding.Load(&config_) < 0) {
+        ESP_LOGW(kTag, "Failed to read system configuration from NVS");
+    }
+    if (!config_.hostname.empty()) {
+        ESP_LOGI(kTag, "Hostname : %s", config_.hostname.c_str());
+        err = esp_netif_set_hostname(wifi_, config_.hostname.c_str());
+        if (err != ESP_OK) {
+            ESP_LOGW(kTag, "Failed to set hostname");
         }
-        nvs_close(my_handle);
-    } else {
-        ESP_LOGW(kTag, "Failed to open NVS handle");
     }
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
@@ -94,6 +119,7 @@ App::App() {
     mqtt_ = MQTT::GetInstance();
     updater_ = Updater::GetInstance();
     prov_ = Provisioner::GetInstance();
+    config_sync_ = ConfigSync::GetInstance();
 }
 
 App* App::GetInstance() {
@@ -124,6 +150,12 @@ void App::Init(StatusLed* led) {
     AddRoute("/config/get-all", HTTP_GET, DoConfigGetAll, this);
     AddRoute("/config/delete-key", HTTP_DELETE, DoConfigDeleteKey, this);
     AddRoute("/config/delete-namespace", HTTP_DELETE, DoConfigDeleteNameSpace, this);
+    AddRoute("/config/bundle-upgrade", HTTP_POST, DoConfigBundleUpgrade, this);
+    AddRoute("/config/diff", HTTP_POST, DoConfigDiff, this);
+    AddRoute("/config/profile", HTTP_GET, DoConfigProfile, this);
+    AddRoute("/config/activate", HTTP_POST, DoConfigActivate, this);
+    AddRoute("/config/rollback", HTTP_POST, DoConfigRollback, this);
+    AddRoute("/config/discard", HTTP_POST, DoConfigDiscard, this);
     AddRoute("/info", HTTP_GET, DoGetInfo, this);
 }
 
@@ -136,6 +168,127 @@ esp_err_t App::PublishMessage(
     }
 }
 
+esp_err_t App::PublishMessageAsync(const char* topic,
+                                   const char* data,
+                                   bool prefixed,
+                                   int qos,
+                                   int retain,
+                                   MQTT::PublishCallback done,
+                                   int timeout_ms) {
+    if (prefixed) {
+        return mqtt_->PublishAsync(
+            mqtt_->Prefixed(topic).c_str(), data, 0, qos, retain, done, timeout_ms);
+    } else {
+        return mqtt_->PublishAsync(topic, data, 0, qos, retain, done, timeout_ms);
+    }
+}
+
+esp_err_t App::InitMQTT(MQTT::LastWill* last_will, int keep_alive, int inbound_workers) {
+    if (inbound_workers > 0) {
+        mqtt_->SetInboundWorkers(inbound_workers);
+    }
+    esp_err_t err = mqtt_->Init(last_will, keep_alive);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Retained configuration documents for this device and for its group
+    const ConfigSync::Config& sync = config_sync_->GetConfig();
+    bool prefixed = sync.device_topic.empty();
+    mqtt_->AddSubscription(
+        prefixed ? "config" : sync.device_topic.c_str(),
+        1,
+        [this](auto topic, auto payload) { ApplyConfig(ConfigSync::kDevice, topic, payload); },
+        prefixed);
+    if (!sync.group_topic.empty()) {
+        mqtt_->AddSubscription(sync.group_topic.c_str(), 1, [this](auto topic, auto payload) {
+            ApplyConfig(ConfigSync::kGroup, topic, payload);
+        });
+    }
+    InitRpc();
+    return ESP_OK;
+}
+
+void App::ApplyConfig(ConfigSync::Source source,
+                      std::string_view topic,
+                      std::string_view payload) {
+    if (payload.empty()) {
+        return;  // retained document cleared
+    }
+
+    bool activate = false;
+    const char* error = nullptr;
+    if (config_sync_->Apply(source, payload.data(), payload.size(), &activate, &error) != ESP_OK) {
+        ESP_LOGE(kTag,
+                 "Configuration from '%.*s' rejected: %s",
+                 (int)topic.size(),
+                 topic.data(),
+                 error != nullptr ? error : "unknown error");
+    } else if (activate) {
+        ESP_LOGW(kTag, "Restarting with the new configuration profile");
+        vTaskDelay(pdMS_TO_TICKS(500));
+        esp_restart();
+    }
+}
+
+esp_err_t App::StartMQTT() {
+    esp_err_t err = mqtt_->Start();
+    if (err == ESP_OK && PendingConfigVerification()) {
+        StartConfigHealthCheck();
+    }
+    return err;
+}
+
+void App::RollbackConfig() {
+    if (profiles_->Rollback() == ESP_OK) {
+        vTaskDelay(pdMS_TO_TICKS(500));
+        esp_restart();
+    }
+}
+
+// Commits the running profile as soon as MQTT connects, rolls it back if it does not
+// connect within `timeout_sec` seconds of the first connection attempt, so that the
+// startup jitter does not count. The check runs on its own task: a rollback restarts
+// the device, which must not hold up the esp_timer task.
+void App::StartConfigHealthCheck(int timeout_sec) {
+    ESP_LOGI(kTag, "Configuration pending verification, %d s to connect to MQTT", timeout_sec);
+    health_timeout_ = (int64_t)timeout_sec * 1000000;
+    health_deadline_ = 0;
+    if (health_task_ == nullptr &&
+        xTaskCreate(ConfigHealthTaskForwarder,
+                    "ConfigHealthTask",
+                    4096,
+                    this,
+                    uxTaskPriorityGet(nullptr),
+                    &health_task_) != pdPASS) {
+        ESP_LOGE(kTag, "Failed to create configuration health check task");
+        health_task_ = nullptr;
+    }
+}
+
+void App::ConfigHealthTask() {
+    while (PendingConfigVerification()) {
+        int64_t now = esp_timer_get_time();
+        if (mqtt_->IsConnected()) {
+            ESP_LOGI(kTag, "MQTT connected, committing configuration");
+            CommitConfig();
+            break;
+        } else if (health_deadline_ == 0) {
+            if (mqtt_->GetState() == MQTT::State::kConnecting ||
+                mqtt_->GetMetrics().failed_attempts > 0) {
+                health_deadline_ = now + health_timeout_;
+            }
+        } else if (now > health_deadline_) {
+            ESP_LOGE(kTag, "MQTT not connected, rolling back configuration");
+            RollbackConfig();
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+    health_task_ = nullptr;
+    vTaskDelete(nullptr);
+}
+
 void App::Provision(const char* country, const char* proof_of_possession) {
     if (led_ != nullptr) {
         led_->Blink(100, 200, StatusLed::kBlue);
@@ -285,6 +438,41 @@ esp_err_t App::DoFirmwareUpgrade(httpd_req_t* req) {
     return ESP_OK;
 }
 
+esp_err_t App::DoConfigBundleUpgrade(httpd_req_t* req) {
+    const int kBufferSize = 1024;
+    App* ctx = (App*)req->user_ctx;
+    std::unique_ptr<char[]> buffer(new char[kBufferSize + 1]);
+
+    int res = ctx->httpd_->Receive(req, buffer.get(), kBufferSize);
+    if (res < 0 || res != req->content_len) {
+        ctx->httpd_->SendError(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive data");
+        return ESP_FAIL;
+    }
+    buffer[res] = '\0';
+
+    std::shared_ptr<cJSON> json(cJSON_Parse(buffer.get()), cJSON_Delete);
+    cJSON* url = cJSON_GetObjectItemCaseSensitive(json.get(), "url");
+    if (!cJSON_IsString(url) || url->valuestring == nullptr) {
+        ctx->httpd_->SendError(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to parse URL");
+        return ESP_FAIL;
+    }
+
+    ctx->updater_->ClearHeaders();
+    ctx->updater_->AddHeader("Accept", "application/octet-stream");
+    cJSON* bearer_token = cJSON_GetObjectItemCaseSensitive(json.get(), "bearer-token");
+    if (cJSON_IsString(bearer_token) && (bearer_token->valuestring != nullptr)) {
+        ctx->updater_->AddBearerToken(bearer_token->valuestring);
+    }
+
+    if (ctx->updater_->UpdateConfigBundle(url->valuestring) != ESP_OK) {
+        ctx->httpd_->SendError(
+            req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to update configuration bundle");
+        return ESP_FAIL;
+    }
+    ctx->httpd_->Reply(req, "Configuration bundle updated\n");
+    return ESP_OK;
+}
+
 esp_err_t App::DoReset(httpd_req_t* req) {
     App* ctx = (App*)req->user_ctx;
     ctx->httpd_->Reply(req, "Resetting device\n");
@@ -0,0 +1,71 @@
+/**
+ ******************************************************************************
+ * @file        : buffer_pool.cpp
+ * @brief       : Fixed Buffer Pool
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Fixed Buffer Pool
+ ******************************************************************************
+ */
+
+#include "buffer_pool.hpp"
+
+#include <stdlib.h>
+
+#include "sdkconfig.h"
+
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+#include <esp_heap_caps.h>
+#endif
+
+esp_err_t BufferPool::Init(size_t count, size_t size) {
+    if (storage_ != nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+    storage_ = std::shared_ptr<char>((char*)heap_caps_malloc(count * size, MALLOC_CAP_SPIRAM),
+                                     heap_caps_free);
+#else
+    storage_ = std::shared_ptr<char>((char*)malloc(count * size), free);
+#endif
+    if (storage_ == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    size_ = size;
+    free_.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        free_.push_back(storage_.get() + i * size);
+    }
+    return ESP_OK;
+}
+
+std::shared_ptr<char> BufferPool::Acquire() {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    char* buffer = nullptr;
+    if (!free_.empty()) {
+        buffer = free_.back();
+        free_.pop_back();
+    }
+    xSemaphoreGive(mutex_);
+    if (buffer == nullptr) {
+        return nullptr;
+    }
+    return std::shared_ptr<char>(buffer, [this](char* b) { Release(b); });
+}
+
+void BufferPool::Release(char* buffer) {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    free_.push_back(buffer);
+    xSemaphoreGive(mutex_);
+}
+
+size_t BufferPool::Available() {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    size_t available = free_.size();
+    xSemaphoreGive(mutex_);
+    return available;
+}
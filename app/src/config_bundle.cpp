@@ -0,0 +1,393 @@
+/**
+ ******************************************************************************
+ * @file        : config_bundle.cpp
+ * @brief       : Read-only Configuration Bundle
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Read-only Configuration Bundle
+ ******************************************************************************
+ */
+
+#include "config_bundle.hpp"
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config_hash.hpp"
+
+static const char* kTag = "config bundle";
+
+ConfigBundle* ConfigBundle::instance_ = nullptr;
+SemaphoreHandle_t ConfigBundle::semaphore_ = xSemaphoreCreateMutex();
+
+ConfigBundle* ConfigBundle::GetInstance() {
+    if (instance_ == nullptr) {
+        xSemaphoreTake(semaphore_, portMAX_DELAY);
+        if (instance_ == nullptr) {
+            instance_ = new ConfigBundle();
+        }
+        xSemaphoreGive(semaphore_);
+    }
+    return instance_;
+}
+
+// Size of an integer value, 0 for strings and blobs
+static size_t IntSize(uint8_t type) {
+    switch (type) {
+        case NVS_TYPE_U8:
+        case NVS_TYPE_I8:
+            return 1;
+        case NVS_TYPE_U16:
+        case NVS_TYPE_I16:
+            return 2;
+        case NVS_TYPE_U32:
+        case NVS_TYPE_I32:
+            return 4;
+        case NVS_TYPE_U64:
+        case NVS_TYPE_I64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+// Offset of a NUL terminated string that ends inside the bundle
+static bool ValidString(const uint8_t* base, uint32_t offset, uint32_t size) {
+    return offset < size && memchr(base + offset, '\0', size - offset) != nullptr;
+}
+
+esp_err_t ConfigBundle::Validate(const void* data, size_t size) {
+    const Header* header = (const Header*)data;
+    if (size < sizeof(Header) || header->magic != kMagic) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (header->version != kVersion) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (header->size > size ||
+        sizeof(Header) + (size_t)header->count * sizeof(Entry) > header->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint32_t crc = esp_rom_crc32_le(
+        0, (const uint8_t*)data + sizeof(Header), header->size - sizeof(Header));
+    if (crc != header->crc) {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    const uint8_t* base = (const uint8_t*)data;
+    const Entry* entries = (const Entry*)(base + sizeof(Header));
+    for (uint16_t i = 0; i < header->count; i++) {
+        const Entry& e = entries[i];
+        if (!ValidString(base, e.name_space, header->size) ||
+            !ValidString(base, e.key, header->size) ||
+            e.value + (size_t)e.length > header->size) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (e.type == NVS_TYPE_STR && (e.length == 0 || base[e.value + e.length - 1] != '\0')) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        // GetInt() copies the whole integer
+        size_t int_size = IntSize(e.type);
+        if (int_size != 0 && e.length != int_size) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        // Find is a binary search: namespaces, then keys, strictly ascending
+        if (i > 0) {
+            const Entry& p = entries[i - 1];
+            int cmp = strcmp((const char*)base + p.name_space, (const char*)base + e.name_space);
+            if (cmp == 0) {
+                cmp = strcmp((const char*)base + p.key, (const char*)base + e.key);
+            }
+            if (cmp >= 0) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+static const esp_partition_t* FindSlot(const char* label, bool second) {
+    char name[sizeof(esp_partition_t::label)];
+    snprintf(name, sizeof(name), second ? "%s_b" : "%s", label);
+    return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, name);
+}
+
+esp_err_t ConfigBundle::Map(const esp_partition_t* partition,
+                            const void** data,
+                            esp_partition_mmap_handle_t* handle) {
+    esp_err_t err = esp_partition_mmap(
+        partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, data, handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(
+            kTag, "Failed to map '%s' partition: %s", partition->label, esp_err_to_name(err));
+        return err;
+    }
+    err = Validate(*data, partition->size);
+    if (err != ESP_OK) {
+        if (err == ESP_ERR_NOT_FOUND) {
+            ESP_LOGI(kTag, "Empty configuration bundle in '%s'", partition->label);
+        } else {
+            ESP_LOGW(kTag,
+                     "Invalid configuration bundle in '%s': %s",
+                     partition->label,
+                     esp_err_to_name(err));
+        }
+        esp_partition_munmap(*handle);
+    }
+    return err;
+}
+
+// Called with the lock held. Unmaps the previous bundle. Callers then invalidate the
+// configuration hashes, which include the defaults (outside the lock: Get() takes both).
+void ConfigBundle::Install(const void* data,
+                           const esp_partition_t* partition,
+                           esp_partition_mmap_handle_t handle,
+                           bool mapped) {
+    if (mapped_) {
+        esp_partition_munmap(mmap_handle_);
+    }
+    partition_ = partition;
+    mmap_handle_ = handle;
+    mapped_ = mapped;
+    base_ = (const uint8_t*)data;
+    header_ = (const Header*)data;
+    entries_ = data != nullptr ? (const Entry*)(base_ + sizeof(Header)) : nullptr;
+}
+
+esp_err_t ConfigBundle::Mount(const char* label) {
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    for (int slot = 0; slot < 2; slot++) {
+        const esp_partition_t* partition = FindSlot(label, slot == 1);
+        if (partition == nullptr) {
+            continue;
+        }
+        const void* data = nullptr;
+        esp_partition_mmap_handle_t handle;
+        err = Map(partition, &data, &handle);
+        if (err == ESP_OK) {
+            ESP_LOGI(kTag,
+                     "Mounted '%s' (%d entries)",
+                     partition->label,
+                     ((const Header*)data)->count);
+            Lock();
+            Install(data, partition, handle, true);
+            Unlock();
+            ConfigHash::Invalidate();
+            return ESP_OK;
+        }
+    }
+    if (err == ESP_ERR_NOT_FOUND) {
+        ESP_LOGD(kTag, "No configuration bundle in '%s'", label);
+    }
+    return err;
+}
+
+esp_err_t ConfigBundle::Attach(const void* data, size_t size) {
+    esp_err_t err = Validate(data, size);
+    if (err != ESP_OK) {
+        ESP_LOGW(kTag, "Invalid configuration bundle: %s", esp_err_to_name(err));
+        return err;
+    }
+    Lock();
+    Install(data, nullptr, 0, false);
+    Unlock();
+    ConfigHash::Invalidate();
+    return ESP_OK;
+}
+
+void ConfigBundle::Unmount() {
+    Lock();
+    Install(nullptr, nullptr, 0, false);
+    Unlock();
+    ConfigHash::Invalidate();
+}
+
+const esp_partition_t* ConfigBundle::InactiveSlot(const char* label) {
+    const esp_partition_t* first = FindSlot(label, false);
+    const esp_partition_t* second = FindSlot(label, true);
+    if (first == nullptr || second == nullptr) {
+        return nullptr;
+    }
+    Lock();
+    const esp_partition_t* inactive = partition_ == first ? second : first;
+    Unlock();
+    return inactive;
+}
+
+esp_err_t ConfigBundle::Activate(const esp_partition_t* partition) {
+    const void* data = nullptr;
+    esp_partition_mmap_handle_t handle;
+    esp_err_t err = Map(partition, &data, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    ESP_LOGI(kTag, "Activating '%s' (%d entries)", partition->label, ((const Header*)data)->count);
+    Lock();
+    const esp_partition_t* previous = partition_;
+    Install(data, partition, handle, true);
+    Unlock();
+    ConfigHash::Invalidate();
+
+    // Until the old header is erased, both slots are valid and Mount keeps
+    // picking the first one: a power loss here only delays the switch.
+    if (previous != nullptr && previous != partition) {
+        err = esp_partition_erase_range(previous, 0, previous->erase_size);
+    }
+    return err;
+}
+
+esp_err_t ConfigBundle::Replace(const esp_partition_t* partition, const void* data, size_t size) {
+    esp_err_t err = Validate(data, size);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    Lock();
+    if (partition_ == partition) {
+        Install(nullptr, nullptr, 0, false);
+    }
+    err = esp_partition_erase_range(partition, 0, partition->size);
+    // Header last: an interrupted write leaves an empty slot, not a corrupted one
+    if (err == ESP_OK) {
+        err = esp_partition_write(partition,
+                                  sizeof(Header),
+                                  (const uint8_t*)data + sizeof(Header),
+                                  size - sizeof(Header));
+    }
+    if (err == ESP_OK) {
+        err = esp_partition_write(partition, 0, data, sizeof(Header));
+    }
+    const void* mapped = nullptr;
+    esp_partition_mmap_handle_t handle;
+    if (err == ESP_OK) {
+        err = Map(partition, &mapped, &handle);
+    }
+    if (err == ESP_OK) {
+        Install(mapped, partition, handle, true);
+    }
+    Unlock();
+    ConfigHash::Invalidate();
+    return err;
+}
+
+const ConfigBundle::Entry* ConfigBundle::Find(const char* name_space, const char* key) {
+    if (!IsMounted()) {
+        return nullptr;
+    }
+    int low = 0;
+    int high = header_->count - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        const Entry* e = &entries_[middle];
+        int cmp = strcmp(String(e->name_space), name_space);
+        if (cmp == 0) {
+            cmp = strcmp(String(e->key), key);
+        }
+        if (cmp == 0) {
+            return e;
+        } else if (cmp < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return nullptr;
+}
+
+esp_err_t ConfigBundle::Get(const char* name_space,
+                            const char* key,
+                            nvs_type_t* type,
+                            const void** value,
+                            size_t* length) {
+    const Entry* e = Find(name_space, key);
+    if (e == nullptr) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *type = (nvs_type_t)e->type;
+    *value = base_ + e->value;
+    *length = e->length;
+    return ESP_OK;
+}
+
+esp_err_t ConfigBundle::GetString(const char* name_space, const char* key, const char** value) {
+    const Entry* e = Find(name_space, key);
+    if (e == nullptr) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (e->type != NVS_TYPE_STR) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    *value = String(e->value);
+    return ESP_OK;
+}
+
+esp_err_t ConfigBundle::GetInt(const char* name_space, const char* key, double* value) {
+    const Entry* e = Find(name_space, key);
+    if (e == nullptr) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    const void* data = base_ + e->value;
+    switch (e->type) {
+        case NVS_TYPE_U8: {
+            uint8_t u8;
+            memcpy(&u8, data, sizeof(u8));
+            *value = u8;
+            break;
+        }
+        case NVS_TYPE_I8: {
+            int8_t i8;
+            memcpy(&i8, data, sizeof(i8));
+            *value = i8;
+            break;
+        }
+        case NVS_TYPE_U16: {
+            uint16_t u16;
+            memcpy(&u16, data, sizeof(u16));
+            *value = u16;
+            break;
+        }
+        case NVS_TYPE_I16: {
+            int16_t i16;
+            memcpy(&i16, data, sizeof(i16));
+            *value = i16;
+            break;
+        }
+        case NVS_TYPE_U32: {
+            uint32_t u32;
+            memcpy(&u32, data, sizeof(u32));
+            *value = u32;
+            break;
+        }
+        case NVS_TYPE_I32: {
+            int32_t i32;
+            memcpy(&i32, data, sizeof(i32));
+            *value = i32;
+            break;
+        }
+        case NVS_TYPE_U64: {
+            uint64_t u64;
+            memcpy(&u64, data, sizeof(u64));
+            *value = u64;
+            break;
+        }
+        case NVS_TYPE_I64: {
+            int64_t i64;
+            memcpy(&i64, data, sizeof(i64));
+            *value = i64;
+            break;
+        }
+        default:
+            return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,279 @@
+/**
+ ******************************************************************************
+ * @file        : config_hash.cpp
+ * @brief       : Configuration Content Hashes
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Configuration Content Hashes
+ ******************************************************************************
+ */
+
+#include "config_hash.hpp"
+
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <string.h>
+
+#include <vector>
+
+#include "config_bundle.hpp"
+#include "nvs_config.hpp"
+
+static const char* kTag = "config hash";
+
+std::map<std::string, ConfigHash::NameSpace> ConfigHash::cache_;
+SemaphoreHandle_t ConfigHash::semaphore_ = xSemaphoreCreateMutex();
+
+template <typename I>
+static esp_err_t ReadInt(esp_err_t (*get)(nvs_handle_t, const char*, I*),
+                         nvs_handle_t handle,
+                         const char* key,
+                         std::vector<uint8_t>* value) {
+    I i;
+    esp_err_t err = get(handle, key, &i);
+    if (err == ESP_OK) {
+        value->assign((const uint8_t*)&i, (const uint8_t*)&i + sizeof(i));
+    }
+    return err;
+}
+
+static esp_err_t ReadValue(nvs_handle_t handle,
+                           const char* key,
+                           nvs_type_t type,
+                           std::vector<uint8_t>* value) {
+    switch (type) {
+        case NVS_TYPE_U8:
+            return ReadInt(nvs_get_u8, handle, key, value);
+        case NVS_TYPE_I8:
+            return ReadInt(nvs_get_i8, handle, key, value);
+        case NVS_TYPE_U16:
+            return ReadInt(nvs_get_u16, handle, key, value);
+        case NVS_TYPE_I16:
+            return ReadInt(nvs_get_i16, handle, key, value);
+        case NVS_TYPE_U32:
+            return ReadInt(nvs_get_u32, handle, key, value);
+        case NVS_TYPE_I32:
+            return ReadInt(nvs_get_i32, handle, key, value);
+        case NVS_TYPE_U64:
+            return ReadInt(nvs_get_u64, handle, key, value);
+        case NVS_TYPE_I64:
+            return ReadInt(nvs_get_i64, handle, key, value);
+        case NVS_TYPE_STR: {
+            size_t length = 0;
+            esp_err_t err = nvs_get_str(handle, key, nullptr, &length);
+            if (err == ESP_OK) {
+                value->resize(length);
+                err = nvs_get_str(handle, key, (char*)value->data(), &length);
+            }
+            return err;
+        }
+        case NVS_TYPE_BLOB: {
+            size_t length = 0;
+            esp_err_t err = nvs_get_blob(handle, key, nullptr, &length);
+            if (err == ESP_OK) {
+                value->resize(length);
+                err = nvs_get_blob(handle, key, value->data(), &length);
+            }
+            return err;
+        }
+        default:
+            return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+}
+
+uint32_t ConfigHash::Of(const char* key, nvs_type_t type, const void* value, size_t length) {
+    uint8_t t = type;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)key, strlen(key) + 1);
+    crc = esp_rom_crc32_le(crc, &t, sizeof(t));
+    return esp_rom_crc32_le(crc, (const uint8_t*)value, length);
+}
+
+// Same conversion as NvsHandle::SetInt
+uint32_t ConfigHash::OfInt(const char* key, nvs_type_t type, double value) {
+    switch (type) {
+        case NVS_TYPE_U8: {
+            uint8_t u8 = value;
+            return Of(key, type, &u8, sizeof(u8));
+        }
+        case NVS_TYPE_I8: {
+            int8_t i8 = value;
+            return Of(key, type, &i8, sizeof(i8));
+        }
+        case NVS_TYPE_U16: {
+            uint16_t u16 = value;
+            return Of(key, type, &u16, sizeof(u16));
+        }
+        case NVS_TYPE_I16: {
+            int16_t i16 = value;
+            return Of(key, type, &i16, sizeof(i16));
+        }
+        case NVS_TYPE_U32: {
+            uint32_t u32 = value;
+            return Of(key, type, &u32, sizeof(u32));
+        }
+        case NVS_TYPE_I32: {
+            int32_t i32 = value;
+            return Of(key, type, &i32, sizeof(i32));
+        }
+        case NVS_TYPE_U64: {
+            uint64_t u64 = value;
+            return Of(key, type, &u64, sizeof(u64));
+        }
+        case NVS_TYPE_I64: {
+            int64_t i64 = value;
+            return Of(key, type, &i64, sizeof(i64));
+        }
+        default:
+            return 0;
+    }
+}
+
+// Hash of the bundle default of `key` in the logical namespace `name_space`
+static bool BundleHash(const char* name_space, const char* key, uint32_t* hash) {
+    if (name_space == nullptr) {
+        return false;
+    }
+    ConfigBundle* bundle = ConfigBundle::GetInstance();
+    nvs_type_t type;
+    const void* value;
+    size_t length;
+    bundle->Lock();
+    bool found = bundle->Get(name_space, key, &type, &value, &length) == ESP_OK;
+    if (found) {
+        *hash = ConfigHash::Of(key, type, value, length);
+    }
+    bundle->Unlock();
+    return found;
+}
+
+// Bundle defaults under the keys NVS does not override, as NvsConfig::GetAll()
+// reports them
+static void AddBundleDefaults(const char* name_space, std::map<std::string, uint32_t>* keys) {
+    if (name_space == nullptr) {
+        return;  // hidden namespace
+    }
+    ConfigBundle* bundle = ConfigBundle::GetInstance();
+    bundle->Lock();
+    for (uint16_t i = 0; i < bundle->Count(); i++) {
+        const ConfigBundle::Entry* entry = bundle->At(i);
+        const char* key = bundle->String(entry->key);
+        if (strcmp(bundle->String(entry->name_space), name_space) == 0 &&
+            keys->find(key) == keys->end()) {
+            (*keys)[key] = ConfigHash::Of(
+                key, (nvs_type_t)entry->type, bundle->String(entry->value), entry->length);
+        }
+    }
+    bundle->Unlock();
+}
+
+esp_err_t ConfigHash::Build(const char* partition, const char* name_space, NameSpace* ns) {
+    esp_err_t err = BuildFromNvs(partition, name_space, ns);
+    if (err == ESP_OK) {
+        AddBundleDefaults(NvsHandle::LogicalNameSpace(name_space), &ns->keys);
+        ns->hash = 0;
+        for (auto& key : ns->keys) {
+            ns->hash ^= key.second;
+        }
+    }
+    return err;
+}
+
+esp_err_t ConfigHash::BuildFromNvs(const char* partition, const char* name_space, NameSpace* ns) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open_from_partition(partition, name_space, NVS_READONLY, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;  // empty namespace
+    } else if (err != ESP_OK) {
+        return err;
+    }
+
+    std::vector<uint8_t> value;
+    nvs_iterator_t it = nullptr;
+    esp_err_t res = nvs_entry_find(partition, name_space, NVS_TYPE_ANY, &it);
+    while (res == ESP_OK) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        err = ReadValue(handle, info.key, info.type, &value);
+        if (err != ESP_OK) {
+            break;
+        }
+        ns->keys[info.key] = Of(info.key, info.type, value.data(), value.size());
+        res = nvs_entry_next(&it);
+    }
+    nvs_release_iterator(it);
+    nvs_close(handle);
+    return err;
+}
+
+esp_err_t ConfigHash::Get(const char* name_space,
+                          uint32_t* hash,
+                          std::map<std::string, uint32_t>* keys) {
+    const char* physical = NvsHandle::PhysicalNameSpace(name_space);
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    auto entry = cache_.find(physical);
+    if (entry == cache_.end()) {
+        NameSpace ns;
+        err = Build(NvsHandle::PartitionOf(name_space), physical, &ns);
+        if (err == ESP_OK) {
+            ESP_LOGD(kTag, "Built hashes of '%s' (%d keys)", physical, (int)ns.keys.size());
+            entry = cache_.emplace(physical, std::move(ns)).first;
+        }
+    }
+    if (err == ESP_OK) {
+        *hash = entry->second.hash;
+        if (keys != nullptr) {
+            *keys = entry->second.keys;
+        }
+    }
+    xSemaphoreGive(semaphore_);
+    return err;
+}
+
+void ConfigHash::Set(const char* name_space, const char* key, uint32_t hash) {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    auto entry = cache_.find(name_space);
+    if (entry != cache_.end()) {
+        uint32_t& key_hash = entry->second.keys[key];  // 0 for a new key
+        entry->second.hash ^= key_hash ^ hash;
+        key_hash = hash;
+    }
+    xSemaphoreGive(semaphore_);
+}
+
+// The bundle default, if any, takes the place of the erased key
+void ConfigHash::Erase(const char* name_space, const char* key) {
+    uint32_t bundle_hash;
+    bool fallback = BundleHash(NvsHandle::LogicalNameSpace(name_space), key, &bundle_hash);
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    auto entry = cache_.find(name_space);
+    if (entry != cache_.end()) {
+        auto key_hash = entry->second.keys.find(key);
+        if (key_hash != entry->second.keys.end()) {
+            entry->second.hash ^= key_hash->second;
+            entry->second.keys.erase(key_hash);
+        }
+        if (fallback) {
+            entry->second.keys[key] = bundle_hash;
+            entry->second.hash ^= bundle_hash;
+        }
+    }
+    xSemaphoreGive(semaphore_);
+}
+
+// Rebuilt on the next Get(), with the bundle defaults
+void ConfigHash::Clear(const char* name_space) { Invalidate(name_space); }
+
+void ConfigHash::Invalidate(const char* name_space) {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    if (name_space == nullptr) {
+        cache_.clear();
+    } else {
+        cache_.erase(name_space);
+    }
+    xSemaphoreGive(semaphore_);
+}
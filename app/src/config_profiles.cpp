@@ -0,0 +1,398 @@
+/**
+ ******************************************************************************
+ * @file        : config_profiles.cpp
+ * @brief       : A/B Configuration Profiles
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : A/B Configuration Profiles
+ ******************************************************************************
+ */
+
+#include "config_profiles.hpp"
+
+#include <esp_log.h>
+#include <nvs.h>
+#include <string.h>
+
+#include <memory>
+
+#include "config_hash.hpp"
+#include "nvs_config.hpp"
+
+static const char* kTag = "config profiles";
+
+// Active slot (bit 0) and state (bits 1..3) share a single key, so that switching
+// profiles is one atomic NVS write.
+static const char* kNameSpace = "profiles";
+static const char* kKey = "profile";
+
+ConfigProfiles* ConfigProfiles::instance_ = nullptr;
+SemaphoreHandle_t ConfigProfiles::semaphore_ = xSemaphoreCreateMutex();
+
+ConfigProfiles* ConfigProfiles::GetInstance() {
+    if (instance_ == nullptr) {
+        xSemaphoreTake(semaphore_, portMAX_DELAY);
+        if (instance_ == nullptr) {
+            instance_ = new ConfigProfiles();
+        }
+        xSemaphoreGive(semaphore_);
+    }
+    return instance_;
+}
+
+const char* ConfigProfiles::StateName(State state) {
+    switch (state) {
+        case kIdle:
+            return "idle";
+        case kStaged:
+            return "staged";
+        case kTrial:
+            return "trial";
+        case kTrying:
+            return "trying";
+        case kConfirmed:
+            return "confirmed";
+        default:
+            return "unknown";
+    }
+}
+
+std::string ConfigProfiles::SlotName(const std::string& name_space, uint8_t slot) {
+    return name_space + "@" + (char)('0' + slot);
+}
+
+static size_t CountEntries(const char* partition, const char* name_space) {
+    size_t count = 0;
+    nvs_iterator_t it = nullptr;
+    esp_err_t res = nvs_entry_find(partition, name_space, NVS_TYPE_ANY, &it);
+    while (res == ESP_OK) {
+        count++;
+        res = nvs_entry_next(&it);
+    }
+    nvs_release_iterator(it);
+    return count;
+}
+
+static esp_err_t CopyValue(nvs_handle_t from, nvs_handle_t to, const char* key, nvs_type_t type) {
+    esp_err_t err;
+    switch (type) {
+        case NVS_TYPE_U8: {
+            uint8_t u8;
+            err = nvs_get_u8(from, key, &u8);
+            return err == ESP_OK ? nvs_set_u8(to, key, u8) : err;
+        }
+        case NVS_TYPE_I8: {
+            int8_t i8;
+            err = nvs_get_i8(from, key, &i8);
+            return err == ESP_OK ? nvs_set_i8(to, key, i8) : err;
+        }
+        case NVS_TYPE_U16: {
+            uint16_t u16;
+            err = nvs_get_u16(from, key, &u16);
+            return err == ESP_OK ? nvs_set_u16(to, key, u16) : err;
+        }
+        case NVS_TYPE_I16: {
+            int16_t i16;
+            err = nvs_get_i16(from, key, &i16);
+            return err == ESP_OK ? nvs_set_i16(to, key, i16) : err;
+        }
+        case NVS_TYPE_U32: {
+            uint32_t u32;
+            err = nvs_get_u32(from, key, &u32);
+            return err == ESP_OK ? nvs_set_u32(to, key, u32) : err;
+        }
+        case NVS_TYPE_I32: {
+            int32_t i32;
+            err = nvs_get_i32(from, key, &i32);
+            return err == ESP_OK ? nvs_set_i32(to, key, i32) : err;
+        }
+        case NVS_TYPE_U64: {
+            uint64_t u64;
+            err = nvs_get_u64(from, key, &u64);
+            return err == ESP_OK ? nvs_set_u64(to, key, u64) : err;
+        }
+        case NVS_TYPE_I64: {
+            int64_t i64;
+            err = nvs_get_i64(from, key, &i64);
+            return err == ESP_OK ? nvs_set_i64(to, key, i64) : err;
+        }
+        case NVS_TYPE_STR: {
+            size_t length = 0;
+            err = nvs_get_str(from, key, nullptr, &length);
+            if (err != ESP_OK) {
+                return err;
+            }
+            std::unique_ptr<char[]> value(new char[length]);
+            err = nvs_get_str(from, key, value.get(), &length);
+            return err == ESP_OK ? nvs_set_str(to, key, value.get()) : err;
+        }
+        case NVS_TYPE_BLOB: {
+            size_t length = 0;
+            err = nvs_get_blob(from, key, nullptr, &length);
+            if (err != ESP_OK) {
+                return err;
+            }
+            std::unique_ptr<uint8_t[]> value(new uint8_t[length > 0 ? length : 1]);
+            err = nvs_get_blob(from, key, value.get(), &length);
+            return err == ESP_OK ? nvs_set_blob(to, key, value.get(), length) : err;
+        }
+        default:
+            return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+}
+
+// Replaces the content of namespace `to` with a copy of namespace `from`
+static esp_err_t CopyNameSpace(const char* partition, const char* from, const char* to) {
+    // Collect the keys first: the iterator must not see the writes
+    std::vector<std::pair<std::string, nvs_type_t>> keys;
+    nvs_iterator_t it = nullptr;
+    esp_err_t res = nvs_entry_find(partition, from, NVS_TYPE_ANY, &it);
+    while (res == ESP_OK) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        keys.push_back({info.key, info.type});
+        res = nvs_entry_next(&it);
+    }
+    nvs_release_iterator(it);
+
+    ConfigHash::Invalidate(to);
+    nvs_handle_t dst;
+    esp_err_t err = nvs_open_from_partition(partition, to, NVS_READWRITE, &dst);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_erase_all(dst);
+    if (err == ESP_OK && !keys.empty()) {
+        nvs_handle_t src;
+        err = nvs_open_from_partition(partition, from, NVS_READONLY, &src);
+        if (err == ESP_OK) {
+            for (auto& key : keys) {
+                err = CopyValue(src, dst, key.first.c_str(), key.second);
+                if (err != ESP_OK) {
+                    ESP_LOGE(kTag,
+                             "Failed to copy '%s:%s': %s",
+                             from,
+                             key.first.c_str(),
+                             esp_err_to_name(err));
+                    break;
+                }
+            }
+            nvs_close(src);
+        }
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(dst);
+    }
+    nvs_close(dst);
+    return err;
+}
+
+void ConfigProfiles::Protect(const char* name_space) {
+    if (strlen(name_space) + 2 >= NVS_NS_NAME_MAX_SIZE) {
+        ESP_LOGE(kTag, "Namespace '%s' is too long for a profile slot", name_space);
+        return;
+    }
+    for (auto& ns : name_spaces_) {
+        if (ns == name_space) {
+            return;
+        }
+    }
+    name_spaces_.push_back(name_space);
+}
+
+bool ConfigProfiles::IsProtected(const char* name_space) {
+    if (!initialized_) {
+        return false;
+    }
+    for (auto& ns : name_spaces_) {
+        if (ns == name_space) {
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t ConfigProfiles::Save(uint8_t active, State state) {
+    NvsHandle handle;
+    esp_err_t err = handle.Open(kNameSpace, NVS_READWRITE);
+    if (err == ESP_OK) {
+        err = handle.SetInt(kKey, NVS_TYPE_U8, (state << 1) | (active & 1));
+    }
+    if (err == ESP_OK) {
+        err = handle.Commit();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(kTag, "Failed to save profile: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+void ConfigProfiles::UpdateAliases() {
+    for (auto& ns : name_spaces_) {
+        NvsHandle::AliasNameSpace(ns.c_str(), SlotName(ns, active_).c_str());
+        NvsHandle::HideNameSpace(ns.c_str());
+        NvsHandle::HideNameSpace(SlotName(ns, 0).c_str());
+        NvsHandle::HideNameSpace(SlotName(ns, 1).c_str());
+    }
+}
+
+// Must run at boot, before the protected namespaces are read
+esp_err_t ConfigProfiles::Init() {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    NvsHandle handle;
+    double profile = 0;
+    if (handle.Open(kNameSpace, NVS_READONLY) == ESP_OK) {
+        handle.GetInt(kKey, NVS_TYPE_U8, &profile);
+    }
+    handle.Close();
+    active_ = (uint8_t)profile & 1;
+    state_ = (State)((uint8_t)profile >> 1);
+
+    esp_err_t err = ESP_OK;
+    if (state_ == kTrial) {
+        // First boot on the new profile: it must be committed before the next one
+        ESP_LOGW(kTag, "Running profile %d, pending verification", active_);
+        state_ = kTrying;
+        err = Save(active_, state_);
+    } else if (state_ == kTrying) {
+        // The new profile was neither committed nor rolled back (crash, watchdog, ...)
+        ESP_LOGE(kTag, "Profile %d not verified, rolling back", active_);
+        active_ ^= 1;
+        state_ = kIdle;
+        err = Save(active_, state_);
+    } else if (state_ > kConfirmed) {
+        state_ = kIdle;
+    }
+
+    // Move namespaces that were written before they were protected into the active slot
+    for (auto& ns : name_spaces_) {
+        const char* partition = NvsHandle::PartitionOf(ns.c_str());
+        std::string slot = SlotName(ns, active_);
+        if (CountEntries(partition, ns.c_str()) > 0 &&
+            CountEntries(partition, slot.c_str()) == 0) {
+            ESP_LOGI(kTag, "Moving '%s' to '%s'", ns.c_str(), slot.c_str());
+            esp_err_t res = CopyNameSpace(partition, ns.c_str(), slot.c_str());
+            if (res == ESP_OK) {
+                nvs_handle_t legacy;
+                res = nvs_open_from_partition(partition, ns.c_str(), NVS_READWRITE, &legacy);
+                if (res == ESP_OK) {
+                    ConfigHash::Invalidate(ns.c_str());
+                    nvs_erase_all(legacy);
+                    res = nvs_commit(legacy);
+                    nvs_close(legacy);
+                }
+            }
+            if (res != ESP_OK) {
+                ESP_LOGE(kTag, "Failed to move '%s': %s", ns.c_str(), esp_err_to_name(res));
+                err = res;
+            }
+        }
+    }
+
+    UpdateAliases();
+    initialized_ = true;
+    xSemaphoreGive(semaphore_);
+    ESP_LOGI(kTag, "Active profile %d (%s)", active_, StateName(state_));
+    return err;
+}
+
+// Prepares the inactive slot for changes (a copy of the active profile, on the first
+// change) and returns the physical namespace to write to.
+esp_err_t ConfigProfiles::Stage(const char* name_space, std::string* staging) {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    esp_err_t err = ESP_OK;
+    if (!initialized_ || state_ == kTrial || state_ == kTrying) {
+        err = ESP_ERR_INVALID_STATE;
+    } else if (state_ != kStaged) {
+        for (auto& ns : name_spaces_) {
+            err = CopyNameSpace(NvsHandle::PartitionOf(ns.c_str()),
+                                SlotName(ns, active_).c_str(),
+                                SlotName(ns, active_ ^ 1).c_str());
+            if (err != ESP_OK) {
+                break;
+            }
+        }
+        if (err == ESP_OK) {
+            err = Save(active_, kStaged);
+        }
+        if (err == ESP_OK) {
+            state_ = kStaged;
+        }
+    }
+    if (err == ESP_OK) {
+        *staging = SlotName(name_space, active_ ^ 1);
+    }
+    xSemaphoreGive(semaphore_);
+    return err;
+}
+
+// Flips the active-slot pointer. The staged profile is used from the next boot on.
+esp_err_t ConfigProfiles::Activate() {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if (state_ == kStaged) {
+        err = Save(active_ ^ 1, kTrial);
+        if (err == ESP_OK) {
+            state_ = kTrial;
+        }
+    }
+    xSemaphoreGive(semaphore_);
+    return err;
+}
+
+esp_err_t ConfigProfiles::Discard() {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if (state_ == kStaged) {
+        err = Save(active_, kIdle);
+        if (err == ESP_OK) {
+            state_ = kIdle;
+        }
+    }
+    xSemaphoreGive(semaphore_);
+    return err;
+}
+
+esp_err_t ConfigProfiles::Commit() {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if (state_ == kTrying) {
+        err = Save(active_, kConfirmed);
+        if (err == ESP_OK) {
+            state_ = kConfirmed;
+            ESP_LOGI(kTag, "Profile %d committed", active_);
+        }
+    }
+    xSemaphoreGive(semaphore_);
+    return err;
+}
+
+// Switches back to the previous profile. The running code keeps the configuration it
+// has already read, so the caller should restart.
+esp_err_t ConfigProfiles::Rollback() {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if (state_ == kTrial) {
+        // Not booted yet: cancel the activation, keep the staged changes
+        err = Save(active_, kStaged);
+        if (err == ESP_OK) {
+            state_ = kStaged;
+        }
+    } else if (state_ == kTrying || state_ == kConfirmed) {
+        err = Save(active_ ^ 1, kIdle);
+        if (err == ESP_OK) {
+            active_ ^= 1;
+            state_ = kIdle;
+            UpdateAliases();
+        }
+    }
+    if (err == ESP_OK) {
+        ESP_LOGW(kTag, "Rolled back to profile %d (%s)", active_, StateName(state_));
+    }
+    xSemaphoreGive(semaphore_);
+    return err;
+}
@@ -0,0 +1,165 @@
+/**
+ ******************************************************************************
+ * @file        : config_sync.cpp
+ * @brief       : Configuration Delivery
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Configuration Delivery
+ ******************************************************************************
+ */
+
+#include "config_sync.hpp"
+
+#include <cJSON.h>
+#include <esp_log.h>
+
+#include <memory>
+
+#include "config_profiles.hpp"
+#include "nvs_config.hpp"
+
+static const char* kTag = "config sync";
+
+static const char* kNameSpace = "cfgsync";
+static const char* kVersionKeys[] = {"device", "group"};
+
+ConfigSync* ConfigSync::instance_ = nullptr;
+SemaphoreHandle_t ConfigSync::semaphore_ = xSemaphoreCreateMutex();
+
+static const NvsBinding<ConfigSync::Config> kConfigBinding =
+    NvsBinding<ConfigSync::Config>("mqtt")
+        .Bind("config-topic", &ConfigSync::Config::device_topic)
+        .Bind("group-topic", &ConfigSync::Config::group_topic);
+
+static esp_err_t Fail(const char** error, const char* message, esp_err_t err = ESP_FAIL) {
+    if (error != nullptr) {
+        *error = message;
+    }
+    return err;
+}
+
+ConfigSync* ConfigSync::GetInstance() {
+    if (instance_ == nullptr) {
+        xSemaphoreTake(semaphore_, portMAX_DELAY);
+        if (instance_ == nullptr) {
+            instance_ = new ConfigSync();
+        }
+        xSemaphoreGive(semaphore_);
+    }
+    return instance_;
+}
+
+ConfigSync::ConfigSync() {
+    if (kConfigBinding.Load(&config_) < 0) {
+        ESP_LOGE(kTag, "Failed to read configuration topics from NVS");
+    }
+}
+
+uint32_t ConfigSync::Version(Source source) {
+    NvsHandle handle;
+    double version = 0;
+    if (handle.Open(kNameSpace, NVS_READONLY) == ESP_OK) {
+        handle.GetInt(kVersionKeys[source], NVS_TYPE_U32, &version);
+    }
+    return version;
+}
+
+esp_err_t ConfigSync::SaveVersion(Source source, uint32_t version) {
+    NvsHandle handle;
+    esp_err_t err = handle.Open(kNameSpace, NVS_READWRITE);
+    if (err == ESP_OK) {
+        err = handle.SetInt(kVersionKeys[source], NVS_TYPE_U32, version);
+    }
+    return err == ESP_OK ? handle.Commit() : err;
+}
+
+esp_err_t ConfigSync::Apply(
+    Source source, const char* data, size_t length, bool* activate, const char** error) {
+    if (activate != nullptr) {
+        *activate = false;
+    }
+    std::shared_ptr<cJSON> json(cJSON_ParseWithLength(data, length), cJSON_Delete);
+    const cJSON* version = cJSON_GetObjectItemCaseSensitive(json.get(), "version");
+    const cJSON* config = cJSON_GetObjectItemCaseSensitive(json.get(), "config");
+    if (!cJSON_IsNumber(version) || version->valuedouble < 1 || !cJSON_IsObject(config)) {
+        return Fail(error, "Invalid configuration document", ESP_ERR_INVALID_ARG);
+    }
+
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    if (source == kDevice) {
+        // Remembered even if the document was already applied: the group must not
+        // override these keys.
+        device_keys_.clear();
+        const cJSON* ns;
+        cJSON_ArrayForEach(ns, config) {
+            const cJSON* key;
+            cJSON_ArrayForEach(key, ns) { device_keys_.insert({ns->string, key->string}); }
+        }
+        device_seen_ = true;
+    }
+
+    uint32_t applied = Version(source);
+    if ((uint32_t)version->valuedouble <= applied) {
+        ESP_LOGI(kTag,
+                 "%s configuration %lu already applied",
+                 kVersionKeys[source],
+                 (unsigned long)applied);
+        xSemaphoreGive(semaphore_);
+        return ESP_OK;
+    }
+
+    esp_err_t err = ESP_OK;
+    int count = 0;
+    const cJSON* ns;
+    cJSON_ArrayForEach(ns, config) {
+        const cJSON* key;
+        cJSON_ArrayForEach(key, ns) {
+            if (source == kGroup && device_keys_.count({ns->string, key->string}) > 0) {
+                continue;
+            }
+            err = NvsConfig::SetKey(ns->string, key->string, key, error);
+            if (err != ESP_OK) {
+                ESP_LOGE(kTag, "Failed to set '%s:%s'", ns->string, key->string);
+                break;
+            }
+            count++;
+        }
+        if (err != ESP_OK) {
+            break;
+        }
+    }
+
+    // A failed document is retried on the next delivery
+    if (err == ESP_OK) {
+        ESP_LOGI(kTag,
+                 "Applied %s configuration %lu (%d keys)",
+                 kVersionKeys[source],
+                 (unsigned long)version->valuedouble,
+                 count);
+        err = SaveVersion(source, version->valuedouble);
+        if (err != ESP_OK) {
+            Fail(error, "Failed to save configuration version");
+        }
+    }
+    if (err == ESP_OK && source == kGroup && !device_seen_) {
+        // The group may have overwritten device keys: apply the device document again
+        err = SaveVersion(kDevice, 0);
+    }
+    xSemaphoreGive(semaphore_);
+
+    const cJSON* activate_json = cJSON_GetObjectItemCaseSensitive(json.get(), "activate");
+    if (err == ESP_OK && cJSON_IsTrue(activate_json) &&
+        ConfigProfiles::GetInstance()->GetState() == ConfigProfiles::kStaged) {
+        err = ConfigProfiles::GetInstance()->Activate();
+        if (err != ESP_OK) {
+            Fail(error, "Failed to activate configuration profile");
+        } else if (activate != nullptr) {
+            *activate = true;
+        }
+    }
+    return err;
+}
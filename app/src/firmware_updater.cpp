@@ -16,12 +16,22 @@
 
 #include <esp_crt_bundle.h>
 #include <esp_event.h>
+#include <esp_http_client.h>
 #include <esp_https_ota.h>
 #include <esp_log.h>
 #include <esp_ota_ops.h>
+#include <esp_partition.h>
 
+#include <memory>
 #include <string>
 
+#include "config_bundle.hpp"
+#include "sdkconfig.h"
+
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+#include <esp_heap_caps.h>
+#endif
+
 static const char* kTag = "firmware_upgrade";
 
 Updater* Updater::instance_ = nullptr;
@@ -123,6 +133,128 @@ esp_err_t Updater::Update(const char* url) {
     return ESP_OK;
 }
 
+// Download a configuration bundle. With a second slot ("<label>_b"), the bundle is
+// written to the slot that is not mapped, header last, and only swapped in once
+// it validates. With a single slot, it is staged in RAM and validated before the
+// partition is rewritten. Either way, a failed download keeps the current bundle.
+esp_err_t Updater::UpdateConfigBundle(const char* url, const char* label) {
+    ConfigBundle* bundle = ConfigBundle::GetInstance();
+    const esp_partition_t* partition = bundle->InactiveSlot(label);
+    bool staged = partition == nullptr;
+    if (staged) {
+        partition =
+            esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    }
+    if (partition == nullptr) {
+        ESP_LOGE(kTag, "No '%s' partition", label);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_http_client_config_t config = {};
+    config.url = url;
+    config.crt_bundle_attach = esp_crt_bundle_attach;
+    std::shared_ptr<esp_http_client> client(esp_http_client_init(&config),
+                                            esp_http_client_cleanup);
+    if (client == nullptr || HttpClientInitCallback(client.get()) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    esp_err_t err = esp_http_client_open(client.get(), 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(kTag, "Failed to open %s: %s", url, esp_err_to_name(err));
+        return err;
+    }
+    int64_t content_length = esp_http_client_fetch_headers(client.get());
+    int status = esp_http_client_get_status_code(client.get());
+    if (status != 200 || content_length > partition->size ||
+        (staged && content_length <= (int64_t)sizeof(ConfigBundle::Header))) {
+        ESP_LOGE(kTag, "Bad response (status %d, length %d)", status, (int)content_length);
+        esp_http_client_close(client.get());
+        return ESP_FAIL;
+    }
+
+    if (staged) {
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+        std::shared_ptr<char> staging(
+            (char*)heap_caps_malloc(content_length, MALLOC_CAP_SPIRAM), heap_caps_free);
+#else
+        std::shared_ptr<char> staging((char*)malloc(content_length), free);
+#endif
+        if (staging == nullptr) {
+            esp_http_client_close(client.get());
+            return ESP_ERR_NO_MEM;
+        }
+        size_t offset = 0;
+        while (err == ESP_OK && offset < (size_t)content_length) {
+            int len = esp_http_client_read(
+                client.get(), staging.get() + offset, content_length - offset);
+            if (len <= 0) {
+                err = ESP_ERR_INVALID_SIZE;
+            } else {
+                offset += len;
+            }
+        }
+        esp_http_client_close(client.get());
+        if (err == ESP_OK) {
+            err = bundle->Replace(partition, staging.get(), offset);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(kTag, "Configuration bundle update failed: %s", esp_err_to_name(err));
+        }
+        return err;
+    }
+
+    // The inactive slot is not mapped: it can be erased while lookups go on
+    err = esp_partition_erase_range(partition, 0, partition->size);
+    if (err != ESP_OK) {
+        esp_http_client_close(client.get());
+        return err;
+    }
+
+    const int kBufferSize = 1024;
+    std::unique_ptr<char[]> buffer(new char[kBufferSize]);
+    ConfigBundle::Header header;
+    size_t offset = 0;
+    while (err == ESP_OK) {
+        int len = esp_http_client_read(client.get(), buffer.get(), kBufferSize);
+        if (len < 0) {
+            err = ESP_FAIL;
+        } else if (len == 0) {
+            break;
+        } else if (offset + len > partition->size) {
+            err = ESP_ERR_INVALID_SIZE;
+        } else {
+            size_t skip = 0;
+            if (offset < sizeof(header)) {
+                skip = std::min(sizeof(header) - offset, (size_t)len);
+                memcpy((char*)&header + offset, buffer.get(), skip);
+            }
+            if (skip < (size_t)len) {
+                err = esp_partition_write(
+                    partition, offset + skip, buffer.get() + skip, len - skip);
+            }
+            offset += len;
+        }
+    }
+    esp_http_client_close(client.get());
+
+    if (err == ESP_OK && offset < sizeof(header)) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK) {
+        err = esp_partition_write(partition, 0, &header, sizeof(header));
+    }
+    if (err == ESP_OK) {
+        err = bundle->Activate(partition);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(kTag, "Configuration bundle update failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(
+        kTag, "Configuration bundle written to '%s' (%d bytes)", partition->label, (int)offset);
+    return ESP_OK;
+}
+
 bool Updater::PendingVerification() {
     const esp_partition_t* running = esp_ota_get_running_partition();
     esp_ota_img_states_t ota_state;
@@ -24,16 +24,14 @@
 #include "esp_mac.h"
 #include "esp_system.h"
 #include "esp_timer.h"
+#include "nvs_config.hpp"
 
 static const char* kTag = "get info";
 
-esp_err_t App::DoGetInfo(httpd_req_t* req) {
-    App* ctx = (App*)req->user_ctx;
-
-    std::shared_ptr<cJSON> response(cJSON_CreateObject(), cJSON_Delete);
-
+// Shared by GET /info and the "info" RPC method
+void App::GetInfo(cJSON* node) {
     cJSON* app_node = cJSON_CreateObject();
-    cJSON_AddItemToObject(response.get(), "app", app_node);
+    cJSON_AddItemToObject(node, "app", app_node);
     const esp_app_desc_t* app_descr = esp_app_get_description();
     cJSON_AddStringToObject(app_node, "app-version", app_descr->version);
     cJSON_AddStringToObject(app_node, "app-name", app_descr->project_name);
@@ -43,10 +41,10 @@ esp_err_t App::DoGetInfo(httpd_req_t* req) {
 
     struct timeval tv_now;
     gettimeofday(&tv_now, NULL);
-    cJSON_AddNumberToObject(response.get(), "time-of-day-sec", tv_now.tv_sec);
+    cJSON_AddNumberToObject(node, "time-of-day-sec", tv_now.tv_sec);
 
     int64_t uptime = esp_timer_get_time() / 1000;
-    cJSON_AddNumberToObject(response.get(), "uptime-msec", uptime);
+    cJSON_AddNumberToObject(node, "uptime-msec", uptime);
 
     uint8_t mac_address[6];
     if (esp_read_mac(mac_address, ESP_MAC_WIFI_STA) == ESP_OK) {
@@ -60,10 +58,10 @@ esp_err_t App::DoGetInfo(httpd_req_t* req) {
                  mac_address[3],
                  mac_address[4],
                  mac_address[5]);
-        cJSON_AddStringToObject(response.get(), "wifi-mac-address", mac_str);
+        cJSON_AddStringToObject(node, "wifi-mac-address", mac_str);
     }
 
-    cJSON_AddStringToObject(response.get(), "hostname", ctx->hostname_);
+    cJSON_AddStringToObject(node, "hostname", hostname_);
 
     UBaseType_t nOfTasks = uxTaskGetNumberOfTasks();
     TaskStatus_t* data = new TaskStatus_t[nOfTasks];
@@ -73,7 +71,7 @@ esp_err_t App::DoGetInfo(httpd_req_t* req) {
         delete[] data;
     } else {
         cJSON* tasks = cJSON_CreateArray();
-        cJSON_AddItemToObject(response.get(), "tasks", tasks);
+        cJSON_AddItemToObject(node, "tasks", tasks);
         for (UBaseType_t i = 0; i < nOfTasks; i++) {
             cJSON* task = cJSON_CreateObject();
 
@@ -125,7 +123,7 @@ esp_err_t App::DoGetInfo(httpd_req_t* req) {
     }
 
     cJSON* heaps = cJSON_CreateObject();
-    cJSON_AddItemToObject(response.get(), "heap", heaps);
+    cJSON_AddItemToObject(node, "heap", heaps);
 
     cJSON* system_heap = cJSON_CreateObject();
     cJSON_AddItemToObject(heaps, "SYSTEM", system_heap);
@@ -155,59 +153,147 @@ esp_err_t App::DoGetInfo(httpd_req_t* req) {
         cJSON_AddNumberToObject(c_heap, "largest-free", info.largest_free_block);
     }
 
+    cJSON* nvs = cJSON_CreateObject();
+    cJSON_AddItemToObject(node, "nvs", nvs);
+    for (auto& partition : NvsHandle::Partitions()) {
+        nvs_stats_t stats;
+        if (nvs_get_stats(partition.c_str(), &stats) != ESP_OK) {
+            continue;
+        }
+        cJSON* p = cJSON_CreateObject();
+        cJSON_AddItemToObject(nvs, partition.c_str(), p);
+        cJSON_AddNumberToObject(p, "used-entries", stats.used_entries);
+        cJSON_AddNumberToObject(p, "free-entries", stats.free_entries);
+        cJSON_AddNumberToObject(p, "total-entries", stats.total_entries);
+        cJSON_AddNumberToObject(p, "namespaces", stats.namespace_count);
+    }
+
+    cJSON* counters = cJSON_CreateObject();
+    cJSON_AddItemToObject(node, "counters", counters);
+    counters_->ForEach([counters](const char* name, uint64_t value) {
+        cJSON_AddNumberToObject(counters, name, value);
+    });
+
+    MQTT::Metrics metrics = mqtt_->GetMetrics();
+    cJSON* mqtt = cJSON_CreateObject();
+    cJSON_AddItemToObject(node, "mqtt", mqtt);
+    cJSON_AddStringToObject(mqtt, "state", MQTT::StateName(mqtt_->GetState()));
+    cJSON_AddNumberToObject(mqtt, "connects", metrics.connects);
+    cJSON_AddNumberToObject(mqtt, "disconnects", metrics.disconnects);
+    cJSON_AddNumberToObject(mqtt, "failed-attempts", metrics.failed_attempts);
+    cJSON_AddNumberToObject(mqtt, "transport-errors", metrics.transport_errors);
+    cJSON_AddNumberToObject(mqtt, "refused", metrics.refused);
+    cJSON_AddNumberToObject(mqtt, "last-errno", metrics.last_errno);
+    cJSON_AddNumberToObject(mqtt, "last-refused-code", metrics.last_refused_code);
+    cJSON_AddNumberToObject(mqtt, "connect-latency-ms", metrics.last_connect_latency_ms);
+    cJSON_AddNumberToObject(mqtt, "connected-ms", metrics.connected_ms);
+    cJSON_AddNumberToObject(mqtt, "backoff-ms", metrics.backoff_ms);
+    cJSON_AddStringToObject(mqtt, "broker", mqtt_->CurrentBroker().c_str());
+    cJSON_AddNumberToObject(mqtt, "failovers", metrics.failovers);
+    cJSON_AddNumberToObject(mqtt, "failover-ms", metrics.last_failover_ms);
+    cJSON_AddNumberToObject(mqtt, "queued", mqtt_->QueuedMessages());
+    cJSON_AddNumberToObject(mqtt, "dropped", mqtt_->DroppedMessages());
+
+    MQTT::PublishMetrics publish = mqtt_->GetPublishMetrics();
+    cJSON* publish_node = cJSON_CreateObject();
+    cJSON_AddItemToObject(mqtt, "publish", publish_node);
+    cJSON_AddNumberToObject(publish_node, "published", publish.published);
+    cJSON_AddNumberToObject(publish_node, "acked", publish.acked);
+    cJSON_AddNumberToObject(publish_node, "in-flight", publish.in_flight);
+    cJSON_AddNumberToObject(publish_node, "retransmits-estimated", publish.retransmits_estimated);
+    cJSON_AddNumberToObject(publish_node, "expired", publish.expired);
+    cJSON_AddNumberToObject(publish_node, "timed-out", publish.timed_out);
+    cJSON_AddNumberToObject(publish_node, "outbox-bytes", publish.outbox_bytes);
+    cJSON_AddNumberToObject(publish_node, "bytes-out", publish.bytes_out);
+    cJSON_AddNumberToObject(publish_node, "bytes-in", publish.bytes_in);
+    cJSON_AddNumberToObject(publish_node, "messages-in", publish.messages_in);
+    cJSON_AddNumberToObject(publish_node, "topic-bytes-saved", publish.topic_bytes_saved);
+    cJSON_AddNumberToObject(publish_node, "ack-latency-max-ms", publish.ack_latency_max_ms);
+    // Bucket i counts the acknowledgements up to bounds[i] ms, the last one the slower ones
+    cJSON* histogram = cJSON_CreateObject();
+    cJSON_AddItemToObject(publish_node, "ack-latency", histogram);
+    cJSON* bounds = cJSON_CreateArray();
+    cJSON* counts = cJSON_CreateArray();
+    cJSON_AddItemToObject(histogram, "bounds-ms", bounds);
+    cJSON_AddItemToObject(histogram, "counts", counts);
+    for (int i = 0; i < MQTT::PublishMetrics::kAckLatencyBuckets; i++) {
+        if (i < MQTT::PublishMetrics::kAckLatencyBuckets - 1) {
+            cJSON_AddItemToArray(
+                bounds, cJSON_CreateNumber(MQTT::PublishMetrics::kAckLatencyBoundsMs[i]));
+        }
+        cJSON_AddItemToArray(counts, cJSON_CreateNumber(publish.ack_latency[i]));
+    }
+
+    MQTT::InboundMetrics inbound = mqtt_->GetInboundMetrics();
+    cJSON* inbound_node = cJSON_CreateObject();
+    cJSON_AddItemToObject(mqtt, "inbound", inbound_node);
+    cJSON_AddNumberToObject(inbound_node, "received", inbound.received);
+    cJSON_AddNumberToObject(inbound_node, "processed", inbound.processed);
+    cJSON_AddNumberToObject(inbound_node, "dropped", inbound.dropped);
+    cJSON_AddNumberToObject(inbound_node, "depth", inbound.depth);
+    cJSON_AddNumberToObject(inbound_node, "max-depth", inbound.max_depth);
+    cJSON_AddNumberToObject(inbound_node, "bytes", inbound.bytes);
+
     switch (esp_reset_reason()) {
         case ESP_RST_UNKNOWN:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "Unknown");
+            cJSON_AddStringToObject(node, "reset-reason", "Unknown");
             break;
         case ESP_RST_POWERON:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "Power On");
+            cJSON_AddStringToObject(node, "reset-reason", "Power On");
             break;
         case ESP_RST_EXT:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "External");
+            cJSON_AddStringToObject(node, "reset-reason", "External");
             break;
         case ESP_RST_SW:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "Software");
+            cJSON_AddStringToObject(node, "reset-reason", "Software");
             break;
         case ESP_RST_PANIC:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "Panic");
+            cJSON_AddStringToObject(node, "reset-reason", "Panic");
             break;
         case ESP_RST_INT_WDT:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "Interrupt Watchdog");
+            cJSON_AddStringToObject(node, "reset-reason", "Interrupt Watchdog");
             break;
         case ESP_RST_TASK_WDT:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "Task Watchdog");
+            cJSON_AddStringToObject(node, "reset-reason", "Task Watchdog");
             break;
         case ESP_RST_WDT:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "Watchdog");
+            cJSON_AddStringToObject(node, "reset-reason", "Watchdog");
             break;
         case ESP_RST_DEEPSLEEP:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "Deep Sleep");
+            cJSON_AddStringToObject(node, "reset-reason", "Deep Sleep");
             break;
         case ESP_RST_BROWNOUT:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "Brownout");
+            cJSON_AddStringToObject(node, "reset-reason", "Brownout");
             break;
         case ESP_RST_SDIO:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "SDIO");
+            cJSON_AddStringToObject(node, "reset-reason", "SDIO");
             break;
         case ESP_RST_USB:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "USB Peripheral");
+            cJSON_AddStringToObject(node, "reset-reason", "USB Peripheral");
             break;
         case ESP_RST_JTAG:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "JTAG");
+            cJSON_AddStringToObject(node, "reset-reason", "JTAG");
             break;
         case ESP_RST_EFUSE:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "EFUSE");
+            cJSON_AddStringToObject(node, "reset-reason", "EFUSE");
             break;
         case ESP_RST_PWR_GLITCH:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "Power Glitch");
+            cJSON_AddStringToObject(node, "reset-reason", "Power Glitch");
             break;
         case ESP_RST_CPU_LOCKUP:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "CPU Lockup");
+            cJSON_AddStringToObject(node, "reset-reason", "CPU Lockup");
             break;
         default:
-            cJSON_AddStringToObject(response.get(), "reset-reason", "Unknown");
+            cJSON_AddStringToObject(node, "reset-reason", "Unknown");
             break;
     }
+}
+
+esp_err_t App::DoGetInfo(httpd_req_t* req) {
+    App* ctx = (App*)req->user_ctx;
+
+    std::shared_ptr<cJSON> response(cJSON_CreateObject(), cJSON_Delete);
+    ctx->GetInfo(response.get());
 
     std::shared_ptr<char> str(cJSON_PrintUnformatted(response.get()), free);
     ctx->httpd_->ReplyJson(req, str.get());
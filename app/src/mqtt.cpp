@@ -15,17 +15,82 @@
 #include "mqtt.hpp"
 
 #include <esp_log.h>
+#include <esp_random.h>
+#include <esp_rom_crc.h>
+#include <fcntl.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
 #include <mqtt_client.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
 
 #include "nvs_config.hpp"
+#include "sdkconfig.h"
+
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+#include <esp_heap_caps.h>
+#endif
+#ifdef CONFIG_MQTT_PROTOCOL_5
+#include <mqtt5_client.h>
+#endif
+#if !CONFIG_IDF_TARGET_LINUX
+#include <esp_mac.h>
+#endif
 
 static const char* kTag = "mqtt";
 
+// The offline queue is drained only while the client outbox stays below this size
+static const int kMaxOutboxSize = 16 * 1024;
+static const int kMaxSendAttempts = 3;  // per queued message, while connected
+static const size_t kMaxEarlyAcks = 8;
+// Limits of one SUBSCRIBE packet, to stay within the client output buffer
+static const int kMaxFiltersPerSubscribe = 16;
+static const size_t kMaxSubscribeBytes = 512;
+// Topics counted for the topic aliases
+static const size_t kMaxAliasCandidates = 64;
+// How long the broker keeps a persistent MQTT 5 session after a disconnect
+static const uint32_t kSessionExpirySec = 7 * 24 * 3600;
+
+// The last broker connected to, preferred at boot (not in "mqtt", which is a
+// protected configuration namespace)
+static const char* kStateNameSpace = "mqtt-state";
+static const int kProbeTimeoutMs = 3000;
+
 MQTT* MQTT::instance_ = nullptr;
 SemaphoreHandle_t MQTT::semaphore_ = xSemaphoreCreateMutex();
 
+static const NvsBinding<MQTT::Config> kConfigBinding =
+    NvsBinding<MQTT::Config>("mqtt")
+        .Bind("topic-base", &MQTT::Config::topic_base)
+        .Bind("broker", &MQTT::Config::broker)
+        .Bind("brokers", &MQTT::Config::brokers)
+        .Bind("username", &MQTT::Config::username)
+        .Bind("password", &MQTT::Config::password)
+        .Bind("client-id", &MQTT::Config::client_id)
+        .Bind("persistent-session", &MQTT::Config::persistent_session)
+        .Bind("protocol-v5", &MQTT::Config::protocol_v5)
+        .Bind("startup-jitter-ms", &MQTT::Config::startup_jitter_ms);
+
+// Copy of a payload kept after the call, in PSRAM when available
+static std::shared_ptr<char> CopyPayload(const char* data, int len) {
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+    std::shared_ptr<char> payload((char*)heap_caps_malloc(len + 1, MALLOC_CAP_SPIRAM),
+                                  heap_caps_free);
+#else
+    std::shared_ptr<char> payload((char*)malloc(len + 1), free);
+#endif
+    if (payload != nullptr && len > 0) {
+        memcpy(payload.get(), data, len);
+    }
+    return payload;
+}
+
 static void LogErrorIfNonZero(const char* message, int errorCode) {
     if (errorCode != 0) {
         ESP_LOGE(kTag, "Last error %s: 0x%x", message, errorCode);
@@ -43,72 +108,197 @@ MQTT* MQTT::GetInstance() {
     return instance_;
 }
 
-void MQTT::AddSubscription(const char* topic, int qos) {
+void MQTT::AddSubscription(const char* topic,
+                           int qos,
+                           TopicTrie::Handler handler,
+                           bool prefixed) {
     subscription t = {
         .topic = std::string(topic),
         .qos = qos,
+        .prefixed = prefixed,
     };
+    xSemaphoreTake(topics_mutex_, portMAX_DELAY);
     subscriptions_.push_back(t);
+    xSemaphoreGive(topics_mutex_);
+    if (handler != nullptr) {
+        (prefixed ? prefixed_handlers_ : handlers_).Add(topic, handler);
+    }
 }
 
-MQTT::MQTT() {
-    connected_ = false;
-    char topic_base[64] = {0};
+std::string MQTT::Prefixed(const char* topic) {
+    xSemaphoreTake(topics_mutex_, portMAX_DELAY);
+    std::string full = topic_base_ + topic;
+    xSemaphoreGive(topics_mutex_);
+    return full;
+}
 
-    NvsHandle handle;
-    handle.Open("mqtt", NVS_READONLY);
+std::string MQTT::TopicBase() {
+    xSemaphoreTake(topics_mutex_, portMAX_DELAY);
+    std::string base = topic_base_;
+    xSemaphoreGive(topics_mutex_);
+    return base;
+}
+
+MQTT::TopicHandle MQTT::RegisterTopic(const char* topic, bool prefixed) {
+    auto full = std::make_shared<const std::string>(prefixed ? Prefixed(topic) : topic);
+    xSemaphoreTake(topics_mutex_, portMAX_DELAY);
+    TopicHandle handle = {.index = (int)topics_.size()};
+    topics_.push_back({topic, prefixed, full});
+    xSemaphoreGive(topics_mutex_);
+    return handle;
+}
 
-    size_t length = sizeof(topic_base);
-    if (handle.GetString("topic-base", topic_base, &length) != ESP_OK) {
-        ESP_LOGE(kTag, "Failed to read topic_base from NVS");
-    } else {
-        topic_base_ = std::string(topic_base);
+// Copying the shared pointer does not allocate
+std::shared_ptr<const std::string> MQTT::TopicName(TopicHandle topic) {
+    std::shared_ptr<const std::string> name;
+    xSemaphoreTake(topics_mutex_, portMAX_DELAY);
+    if (topic.index >= 0 && topic.index < (int)topics_.size()) {
+        name = topics_[topic.index].full;
     }
-    handle.Close();
+    xSemaphoreGive(topics_mutex_);
+    return name;
 }
 
-esp_err_t MQTT::Init(LastWill* last_will, int keep_alive) {
-    NvsHandle handle;
+void MQTT::SetTopicBase(const char* topic_base) {
+    xSemaphoreTake(topics_mutex_, portMAX_DELAY);
+    if (topic_base_ == topic_base) {
+        xSemaphoreGive(topics_mutex_);
+        return;
+    }
+    std::string previous = topic_base_;
+    topic_base_ = topic_base;
+    for (auto& t : topics_) {
+        if (t.prefixed) {
+            t.full = std::make_shared<const std::string>(topic_base_ + t.topic);
+        }
+    }
+    std::vector<subscription> prefixed;
+    for (auto& s : subscriptions_) {
+        if (s.prefixed) {
+            prefixed.push_back(s);
+        }
+    }
+    // Not connected: the next connection subscribes with the new base
+    subscribed_ = false;
+    xSemaphoreGive(topics_mutex_);
+    ESP_LOGI(kTag, "Topic base changed from %s to %s", previous.c_str(), topic_base);
+
+    if (client_ == nullptr || !IsConnected()) {
+        return;
+    }
+    for (auto& s : prefixed) {
+        esp_mqtt_client_unsubscribe(client_, (previous + s.topic).c_str());
+        esp_mqtt_client_subscribe(client_, (topic_base + s.topic).c_str(), s.qos);
+    }
+}
 
-    char broker[64] = {0};
-    char username[64] = {0};
-    char password[64] = {0};
+// Follows mqtt:topic-base in the running configuration
+void MQTT::ConfigChanged(const char* name_space, const char* key) {
+    if (strcmp(name_space, "mqtt") != 0 || (key != nullptr && strcmp(key, "topic-base") != 0)) {
+        return;
+    }
+    Config config;
+    if (kConfigBinding.Load(&config) >= 0) {
+        SetTopicBase(config.topic_base.c_str());
+    }
+}
 
+MQTT::MQTT() {
+    queue_mutex_ = xSemaphoreCreateMutex();
+    topics_mutex_ = xSemaphoreCreateMutex();
+    v5_mutex_ = xSemaphoreCreateMutex();
+    requests_mutex_ = xSemaphoreCreateMutex();
+    inbound_mutex_ = xSemaphoreCreateMutex();
+    state_mutex_ = xSemaphoreCreateMutex();
+    if (kConfigBinding.Load(&config_) < 0) {
+        ESP_LOGE(kTag, "Failed to read MQTT configuration from NVS");
+    }
+    topic_base_ = config_.topic_base;
+    NvsConfig::OnChange(
+        [this](const char* name_space, const char* key) { ConfigChanged(name_space, key); });
+
+    size_t start = 0;
+    while (start < config_.brokers.size()) {
+        size_t end = config_.brokers.find(',', start);
+        std::string uri = config_.brokers.substr(start, end - start);
+        uri.erase(0, uri.find_first_not_of(" "));
+        uri.erase(uri.find_last_not_of(" ") + 1);
+        if (!uri.empty()) {
+            brokers_.push_back(uri);
+        }
+        start = end == std::string::npos ? end : end + 1;
+    }
+    if (brokers_.empty()) {
+        brokers_.push_back(config_.broker);
+    }
+
+    NvsHandle handle;
+    std::string last_good;
+    if (handle.Open(kStateNameSpace, NVS_READONLY) == ESP_OK &&
+        handle.GetString("broker", &last_good) == ESP_OK) {
+        for (size_t i = 0; i < brokers_.size(); i++) {
+            if (brokers_[i] == last_good) {
+                broker_ = good_broker_ = i;
+            }
+        }
+    }
+}
+
+esp_err_t MQTT::Init(LastWill* last_will, int keep_alive) {
     fatal_error_ = false;
 
-    handle.Open("mqtt", NVS_READONLY);
-    size_t length = sizeof(broker);
-    if (handle.GetString("broker", broker, &length) != ESP_OK) {
+    if (brokers_[broker_].empty()) {
         ESP_LOGE(kTag, "Failed to read broker from NVS");
         fatal_error_ = true;
         return ESP_FAIL;
     }
 
-    length = sizeof(username);
-    handle.GetString("username", username, &length);
-    length = sizeof(password);
-    handle.GetString("password", password, &length);
-    handle.Close();
-
     esp_mqtt_client_config_t mqtt_cfg = {};
-    mqtt_cfg.broker.address.uri = broker;
-    if (strlen(username) > 0 && strlen(password) > 0) {
-        mqtt_cfg.credentials.username = username;
-        mqtt_cfg.credentials.authentication.password = password;
+    mqtt_cfg.broker.address.uri = brokers_[broker_].c_str();
+    if (!config_.username.empty() && !config_.password.empty()) {
+        mqtt_cfg.credentials.username = config_.username.c_str();
+        mqtt_cfg.credentials.authentication.password = config_.password.c_str();
     }
     if (last_will != nullptr) {
         mqtt_cfg.session.last_will = *last_will;
     }
 
     mqtt_cfg.session.keepalive = keep_alive;
+    mqtt_cfg.session.disable_clean_session = config_.persistent_session != 0;
+    if (!config_.client_id.empty()) {
+        mqtt_cfg.credentials.client_id = config_.client_id.c_str();
+    }
+    // ScheduleReconnect() ends esp-mqtt's reconnect wait earlier, with
+    // esp_mqtt_client_reconnect(); this timeout is only a fallback, after the
+    // longest backoff and startup delay
+    mqtt_cfg.network.reconnect_timeout_ms = 2 * backoff_max_ms_ + config_.startup_jitter_ms;
+    mqtt_cfg.session.message_retransmit_timeout = kRetransmitTimeoutMs;
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    v5_ = config_.protocol_v5 != 0;
+    if (v5_) {
+        mqtt_cfg.session.protocol_ver = MQTT_PROTOCOL_V_5;
+    }
+#else
+    if (config_.protocol_v5 != 0) {
+        ESP_LOGW(kTag, "MQTT 5 requires CONFIG_MQTT_PROTOCOL_5, using MQTT 3.1.1");
+    }
+#endif
 
-    ESP_LOGI(kTag, "MQTT URI: %s", broker);
+    ESP_LOGI(kTag, "MQTT URI: %s", brokers_[broker_].c_str());
     client_ = esp_mqtt_client_init(&mqtt_cfg);
     if (client_ == nullptr) {
         ESP_LOGE(kTag, "esp_mqtt_client_init failed");
         fatal_error_ = true;
         return ESP_FAIL;
     }
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    if (v5_ && config_.persistent_session != 0) {
+        // Without an expiry interval, an MQTT 5 session ends with the connection
+        esp_mqtt5_connection_property_config_t property = {};
+        property.session_expiry_interval = kSessionExpirySec;
+        esp_mqtt5_client_set_connect_property(client_, &property);
+    }
+#endif
     esp_err_t err = esp_mqtt_client_register_event(
         client_, (esp_mqtt_event_id_t)ESP_EVENT_ANY_ID, EventHandlerForwarder, this);
     if (err != ESP_OK) {
@@ -116,6 +306,62 @@ esp_err_t MQTT::Init(LastWill* last_will, int keep_alive) {
         fatal_error_ = true;
         return err;
     }
+    if (drain_task_ == nullptr) {
+        xTaskCreate(DrainTaskForwarder, "mqtt_drain", 4096, this, 5, &drain_task_);
+    }
+    StartInboundWorkers();
+    if (ack_timer_ == nullptr) {
+        const esp_timer_create_args_t args = {
+            .callback = AckTimerForwarder,
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "mqtt_acks",
+            .skip_unhandled_events = true,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &ack_timer_));
+        ESP_ERROR_CHECK(esp_timer_start_periodic(ack_timer_, 1000000));
+    }
+    if (request_timer_ == nullptr) {
+        const esp_timer_create_args_t args = {
+            .callback = RequestTimerForwarder,
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "mqtt_requests",
+            .skip_unhandled_events = true,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &request_timer_));
+    }
+    if (trailing_timer_ == nullptr) {
+        const esp_timer_create_args_t args = {
+            .callback = TrailingTimerForwarder,
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "mqtt_trailing",
+            .skip_unhandled_events = true,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &trailing_timer_));
+    }
+    if (reconnect_timer_ == nullptr) {
+        const esp_timer_create_args_t args = {
+            .callback = ReconnectTimerForwarder,
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "mqtt_reconnect",
+            .skip_unhandled_events = true,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &reconnect_timer_));
+    }
+    if (probe_timer_ == nullptr && brokers_.size() > 1) {
+        const esp_timer_create_args_t args = {
+            .callback = ProbeTimerForwarder,
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "mqtt_probe",
+            .skip_unhandled_events = true,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &probe_timer_));
+        ESP_ERROR_CHECK(esp_timer_start_periodic(probe_timer_, probe_interval_sec_ * 1000000LL));
+    }
     return ESP_OK;
 }
 
@@ -124,15 +370,353 @@ esp_err_t MQTT::Start() {
         ESP_LOGE(kTag, "MQTT not initialized");
         return ESP_FAIL;
     }
+    attempt_start_ = esp_timer_get_time();
+    lost_at_ = attempt_start_;
+
+    uint32_t delay = StartupDelayMs();
+    if (delay > 0) {
+        if (start_timer_ == nullptr) {
+            const esp_timer_create_args_t args = {
+                .callback = StartTimerForwarder,
+                .arg = this,
+                .dispatch_method = ESP_TIMER_TASK,
+                .name = "mqtt_start",
+                .skip_unhandled_events = true,
+            };
+            ESP_ERROR_CHECK(esp_timer_create(&args, &start_timer_));
+        }
+        xSemaphoreTake(state_mutex_, portMAX_DELAY);
+        metrics_.backoff_ms = delay;
+        xSemaphoreGive(state_mutex_);
+        ESP_LOGI(kTag, "Connecting in %u ms (startup jitter)", (unsigned)delay);
+        SetState(State::kBackoff);
+        esp_timer_start_once(start_timer_, delay * 1000ULL);
+        return ESP_OK;
+    }
+    return StartClient();
+}
+
+esp_err_t MQTT::StartClient() {
+    SetState(State::kConnecting);
     esp_err_t err = esp_mqtt_client_start(client_);
     if (err != ESP_OK) {
         ESP_LOGE(kTag, "esp_mqtt_client_start failed: 0x%x", err);
+        SetState(State::kStopped);
         return err;
     }
     ESP_LOGI(kTag, "MQTT started");
     return ESP_OK;
 }
 
+void MQTT::SetStartupJitter(uint32_t window_ms) {
+    config_.startup_jitter_ms = window_ms;
+}
+
+// The same device always gets the same delay, and a fleet is spread evenly over
+// the window: after a power failure, devices keep their order instead of
+// colliding again on the next attempt.
+uint32_t MQTT::StartupDelayMs() {
+    if (config_.startup_jitter_ms == 0) {
+        return 0;
+    }
+#if CONFIG_IDF_TARGET_LINUX
+    std::string id = config_.client_id + config_.topic_base;
+    uint32_t hash = esp_rom_crc32_le(0, (const uint8_t*)id.data(), id.size());
+#else
+    uint8_t mac[6] = {};
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    uint32_t hash = esp_rom_crc32_le(0, mac, sizeof(mac));
+#endif
+    return hash % config_.startup_jitter_ms;
+}
+
+void MQTT::SetBackoff(uint32_t min_ms, uint32_t max_ms) {
+    backoff_min_ms_ = min_ms;
+    backoff_max_ms_ = max_ms;
+}
+
+const char* MQTT::StateName(State state) {
+    switch (state) {
+        case State::kStopped:
+            return "stopped";
+        case State::kConnecting:
+            return "connecting";
+        case State::kConnected:
+            return "connected";
+        case State::kBackoff:
+            return "backoff";
+        default:
+            return "unknown";
+    }
+}
+
+void MQTT::SetFailover(int attempts, int probe_interval_sec) {
+    failover_attempts_ = attempts;
+    probe_interval_sec_ = probe_interval_sec;
+    if (probe_timer_ != nullptr) {
+        esp_timer_stop(probe_timer_);
+        esp_timer_start_periodic(probe_timer_, probe_interval_sec_ * 1000000LL);
+    }
+}
+
+// Takes effect on the next connection attempt
+// Called on the MQTT task, while disconnected
+void MQTT::SelectBroker(int broker) {
+    xSemaphoreTake(state_mutex_, portMAX_DELAY);
+    broker_ = broker;
+    broker_failures_ = 0;
+    xSemaphoreGive(state_mutex_);
+    ESP_LOGW(kTag, "Switching to broker %d: %s", broker, brokers_[broker].c_str());
+    esp_mqtt_client_set_uri(client_, brokers_[broker].c_str());
+}
+
+void MQTT::SaveLastGoodBroker() {
+    NvsHandle handle;
+    esp_err_t err = handle.Open(kStateNameSpace, NVS_READWRITE);
+    if (err == ESP_OK) {
+        err = handle.SetString("broker", brokers_[broker_].c_str());
+    }
+    if (err == ESP_OK) {
+        err = handle.Commit();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(kTag, "Failed to save the broker: %s", esp_err_to_name(err));
+    }
+}
+
+// Returns true if a TCP connection to the host and port of `uri` succeeds
+static bool Reachable(const std::string& uri) {
+    size_t scheme = uri.find("://");
+    if (scheme == std::string::npos) {
+        return false;
+    }
+    std::string s = uri.substr(0, scheme);
+    std::string host = uri.substr(scheme + 3);
+    host = host.substr(0, host.find('/'));
+    host = host.substr(host.find('@') == std::string::npos ? 0 : host.find('@') + 1);
+    std::string port = s == "mqtts" ? "8883" : s == "ws" ? "80" : s == "wss" ? "443" : "1883";
+    size_t colon = host.rfind(':');
+    if (colon != std::string::npos) {
+        port = host.substr(colon + 1);
+        host.erase(colon);
+    }
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || res == nullptr) {
+        return false;
+    }
+    bool reachable = false;
+    int sock = socket(res->ai_family, res->ai_socktype, 0);
+    if (sock >= 0) {
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+        if (connect(sock, res->ai_addr, res->ai_addrlen) == 0) {
+            reachable = true;
+        } else {
+            fd_set fds;
+            FD_ZERO(&fds);
+            FD_SET(sock, &fds);
+            struct timeval tv = {.tv_sec = kProbeTimeoutMs / 1000, .tv_usec = 0};
+            int error = 0;
+            socklen_t len = sizeof(error);
+            reachable = select(sock + 1, nullptr, &fds, nullptr, &tv) == 1 &&
+                        getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0;
+        }
+        close(sock);
+    }
+    freeaddrinfo(res);
+    return reachable;
+}
+
+void MQTT::ProbeTimerForwarder(void* arg) {
+    MQTT* instance = static_cast<MQTT*>(arg);
+    xSemaphoreTake(instance->state_mutex_, portMAX_DELAY);
+    bool probe = instance->broker_ != 0 && instance->state_ == State::kConnected &&
+                 !instance->probing_ && !instance->failback_;
+    instance->probing_ = probe;
+    xSemaphoreGive(instance->state_mutex_);
+    if (probe &&
+        xTaskCreate(ProbeTask, "mqtt_probe", 4096, instance, 3, nullptr) != pdPASS) {
+        xSemaphoreTake(instance->state_mutex_, portMAX_DELAY);
+        instance->probing_ = false;
+        xSemaphoreGive(instance->state_mutex_);
+    }
+}
+
+// Falls back to the first broker when it accepts TCP connections again. The probe
+// blocks, so it runs on its own task; the broker is switched by ScheduleReconnect()
+// on the MQTT task, once disconnected.
+void MQTT::ProbeTask(void* arg) {
+    MQTT* instance = static_cast<MQTT*>(arg);
+    bool reachable = Reachable(instance->brokers_[0]);
+    xSemaphoreTake(instance->state_mutex_, portMAX_DELAY);
+    instance->probing_ = false;
+    bool failback = reachable && instance->broker_ != 0 && instance->state_ == State::kConnected;
+    instance->failback_ = instance->failback_ || failback;
+    xSemaphoreGive(instance->state_mutex_);
+    if (failback) {
+        ESP_LOGI(kTag, "Broker 0 is reachable again");
+        esp_mqtt_client_disconnect(instance->client_);
+    }
+    vTaskDelete(nullptr);
+}
+
+MQTT::Metrics MQTT::GetMetrics() {
+    xSemaphoreTake(state_mutex_, portMAX_DELAY);
+    Metrics metrics = metrics_;
+    metrics.broker = broker_;
+    if (state_ == State::kConnected) {
+        metrics.connected_ms += (esp_timer_get_time() - connected_since_) / 1000;
+    }
+    xSemaphoreGive(state_mutex_);
+    return metrics;
+}
+
+MQTT::State MQTT::GetState() {
+    xSemaphoreTake(state_mutex_, portMAX_DELAY);
+    State state = state_;
+    xSemaphoreGive(state_mutex_);
+    return state;
+}
+
+bool MQTT::IsConnected() {
+    return GetState() == State::kConnected;
+}
+
+// Called on the MQTT task, by Start() and by the startup timer
+void MQTT::SetState(State state) {
+    xSemaphoreTake(state_mutex_, portMAX_DELAY);
+    State from = state_;
+    if (from == state) {
+        xSemaphoreGive(state_mutex_);
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    bool new_broker = false;
+    if (state == State::kConnected) {
+        metrics_.connects++;
+        metrics_.last_connect_latency_ms = (now - attempt_start_) / 1000;
+        connected_since_ = now;
+        attempt_ = 0;
+        broker_failures_ = 0;
+        if (broker_ != good_broker_) {
+            metrics_.failovers++;
+            metrics_.last_failover_ms = (now - lost_at_) / 1000;
+            good_broker_ = broker_;
+            new_broker = true;
+        }
+    } else if (from == State::kConnected) {
+        metrics_.disconnects++;
+        metrics_.connected_ms += (now - connected_since_) / 1000;
+    } else if (from == State::kConnecting && state == State::kBackoff) {
+        metrics_.failed_attempts++;
+    }
+    state_ = state;
+    xSemaphoreGive(state_mutex_);
+
+    ESP_LOGI(kTag, "State: %s -> %s", StateName(from), StateName(state));
+    if (new_broker) {
+        SaveLastGoodBroker();
+    }
+    for (auto& callback : state_callbacks_) {
+        callback(from, state);
+    }
+}
+
+// The first connection after boot always subscribes, as the firmware may have
+// changed the subscriptions since the broker stored the session.
+void MQTT::Subscribe(bool session_present) {
+    xSemaphoreTake(topics_mutex_, portMAX_DELAY);
+    if (session_present && subscribed_) {
+        xSemaphoreGive(topics_mutex_);
+        ESP_LOGI(kTag, "Session present, subscriptions kept");
+        return;
+    }
+    std::vector<subscription> filters;
+    filters.reserve(subscriptions_.size());
+    for (auto& s : subscriptions_) {
+        filters.push_back({s.prefixed ? topic_base_ + s.topic : s.topic, s.qos, false});
+    }
+    xSemaphoreGive(topics_mutex_);
+
+    std::vector<esp_mqtt_topic_t> batch;
+    size_t bytes = 0;
+    bool ok = true;
+    for (size_t i = 0; i < filters.size(); i++) {
+        const std::string& filter = filters[i].topic;
+        ESP_LOGI(kTag, "- Subscribing to %s", filter.c_str());
+        batch.push_back({.filter = filter.c_str(), .qos = filters[i].qos});
+        bytes += filter.size() + 3;  // length and options
+        bool last = i + 1 == filters.size();
+        if (last || batch.size() >= kMaxFiltersPerSubscribe || bytes >= kMaxSubscribeBytes) {
+            if (esp_mqtt_client_subscribe_multiple(client_, batch.data(), batch.size()) < 0) {
+                ESP_LOGE(kTag, "Failed to subscribe to %d filters", (int)batch.size());
+                ok = false;
+            }
+            batch.clear();
+            bytes = 0;
+        }
+    }
+    xSemaphoreTake(topics_mutex_, portMAX_DELAY);
+    subscribed_ = subscribed_ || ok;
+    xSemaphoreGive(topics_mutex_);
+}
+
+// Spreads reconnects of a fleet after a broker restart ("equal jitter")
+void MQTT::ScheduleReconnect() {
+    xSemaphoreTake(state_mutex_, portMAX_DELAY);
+    State state = state_;
+    bool failback = failback_;
+    failback_ = false;
+    bool failover = state == State::kConnecting && brokers_.size() > 1 &&
+                    ++broker_failures_ >= failover_attempts_;
+    xSemaphoreGive(state_mutex_);
+
+    if (state == State::kConnected) {
+        lost_at_ = esp_timer_get_time();
+    }
+    if (failback) {
+        SelectBroker(0);
+        attempt_ = 0;
+    } else if (failover) {
+        SelectBroker((broker_ + 1) % brokers_.size());
+        attempt_ = 0;
+    }
+
+    uint32_t delay = backoff_max_ms_;
+    if (attempt_ < 31 && ((uint64_t)backoff_min_ms_ << attempt_) < backoff_max_ms_) {
+        delay = backoff_min_ms_ << attempt_;
+    }
+    delay = delay / 2 + esp_random() % (delay / 2 + 1);
+    if (state == State::kConnected) {
+        // A broker restart drops the whole fleet: spread the reconnects, and the
+        // resubscriptions and queued publishes that follow, as at startup
+        delay += StartupDelayMs();
+    }
+    attempt_++;
+    xSemaphoreTake(state_mutex_, portMAX_DELAY);
+    metrics_.backoff_ms = delay;
+    xSemaphoreGive(state_mutex_);
+    ESP_LOGI(kTag, "Reconnecting in %u ms (attempt %u)", (unsigned)delay, (unsigned)attempt_);
+    SetState(State::kBackoff);
+    esp_timer_stop(reconnect_timer_);
+    esp_timer_start_once(reconnect_timer_, delay * 1000ULL);
+}
+
+// Ends the reconnect wait of esp-mqtt, which only succeeds while the client waits
+void MQTT::ReconnectTimerForwarder(void* arg) {
+    MQTT* instance = static_cast<MQTT*>(arg);
+    esp_err_t err = esp_mqtt_client_reconnect(instance->client_);
+    if (err != ESP_OK) {
+        ESP_LOGW(kTag,
+                 "esp_mqtt_client_reconnect failed (state %s): %s",
+                 StateName(instance->GetState()),
+                 esp_err_to_name(err));
+    }
+}
+
 esp_err_t MQTT::RegisterEventHandler(esp_mqtt_event_id_t event,
                                      esp_event_handler_t event_handler,
                                      void* event_handler_arg) {
@@ -148,40 +732,766 @@ esp_err_t MQTT::Publish(const char* topic, const char* data, int len, int qos, i
         ESP_LOGE(kTag, "MQTT not initialized");
         return ESP_FAIL;
     }
-    if (!connected_) {
-        ESP_LOGE(kTag, "Not connected");
+    if (len == 0 && data != nullptr) {
+        len = strlen(data);
+    }
+    PolicyCheck check = Suppress(topic, data, len, qos, retain, nullptr);
+    if (check.suppress) {
+        return ESP_OK;
+    }
+
+    // Queued messages go first, to keep the order
+    bool connected = IsConnected();
+    xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+    bool direct = connected && queue_.empty() && !draining_;
+    xSemaphoreGive(queue_mutex_);
+    if (direct) {
+        size_t bytes;
+        int msg_id = Send(topic, data, len, qos, retain, nullptr, false, &bytes);
+        if (msg_id >= 0) {
+            Published(topic, check);
+            TrackAck(msg_id, bytes, qos, nullptr, kPublishTimeoutMs);
+            return msg_id;
+        }
+    }
+    esp_err_t err = Enqueue(topic, data, len, qos, retain);
+    if (err == ESP_OK) {
+        Published(topic, check);
+    }
+    return err;
+}
+
+esp_err_t MQTT::Publish(TopicHandle topic, const char* data, int len, int qos, int retain) {
+    std::shared_ptr<const std::string> name = TopicName(topic);
+    if (name == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return Publish(name->c_str(), data, len, qos, retain);
+}
+
+esp_err_t MQTT::PublishAsync(TopicHandle topic,
+                             const char* data,
+                             int len,
+                             int qos,
+                             int retain,
+                             PublishCallback done,
+                             int timeout_ms) {
+    std::shared_ptr<const std::string> name = TopicName(topic);
+    if (name == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return PublishAsync(name->c_str(), data, len, qos, retain, done, timeout_ms);
+}
+
+esp_err_t MQTT::PublishAsync(const char* topic,
+                             const char* data,
+                             int len,
+                             int qos,
+                             int retain,
+                             PublishCallback done,
+                             int timeout_ms) {
+    return Submit(topic, data, len, qos, retain, nullptr, done, timeout_ms);
+}
+
+esp_err_t MQTT::PublishAsync(const char* topic,
+                             const char* data,
+                             int len,
+                             int qos,
+                             int retain,
+                             const Properties& properties,
+                             PublishCallback done,
+                             int timeout_ms) {
+    return Submit(topic,
+                  data,
+                  len,
+                  qos,
+                  retain,
+                  std::make_shared<const Properties>(properties),
+                  done,
+                  timeout_ms);
+}
+
+esp_err_t MQTT::Submit(const char* topic,
+                       const char* data,
+                       int len,
+                       int qos,
+                       int retain,
+                       std::shared_ptr<const Properties> properties,
+                       PublishCallback done,
+                       int timeout_ms,
+                       bool policies) {
+    if (fatal_error_) {
+        ESP_LOGE(kTag, "MQTT not initialized");
         return ESP_FAIL;
     }
-    return esp_mqtt_client_publish(client_, topic, data, len, qos, retain);
+    if (len == 0 && data != nullptr) {
+        len = strlen(data);
+    }
+    PolicyCheck check;
+    if (policies) {
+        check = Suppress(topic, data, len, qos, retain, properties);
+    }
+    if (check.suppress) {
+        if (done != nullptr) {
+            done(ESP_OK);
+        }
+        return ESP_OK;
+    }
+
+    bool connected = IsConnected();
+    xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+    bool direct = connected && queue_.empty() && !draining_;
+    xSemaphoreGive(queue_mutex_);
+    if (direct) {
+        // Only copies the message into the outbox; the MQTT task sends it
+        size_t bytes;
+        int msg_id = Send(topic, data, len, qos, retain, properties.get(), true, &bytes);
+        if (msg_id >= 0) {
+            Published(topic, check);
+            TrackAck(msg_id, bytes, qos, done, timeout_ms);
+            return ESP_OK;
+        }
+    }
+    esp_err_t err = Enqueue(topic, data, len, qos, retain, done, timeout_ms, properties);
+    if (err == ESP_OK) {
+        Published(topic, check);
+    }
+    return err;
+}
+
+void MQTT::SetTopicAliases(int max_aliases, int min_publishes) {
+    xSemaphoreTake(v5_mutex_, portMAX_DELAY);
+    max_aliases_ = alias_limit_ = max_aliases;
+    alias_min_publishes_ = min_publishes;
+    xSemaphoreGive(v5_mutex_);
+}
+
+// Aliases only live as long as the connection
+void MQTT::ResetTopicAliases() {
+    xSemaphoreTake(v5_mutex_, portMAX_DELAY);
+    for (auto& entry : aliases_) {
+        entry.second.alias = 0;
+        entry.second.announced = false;
+    }
+    next_alias_ = 1;
+    alias_limit_ = max_aliases_;
+    xSemaphoreGive(v5_mutex_);
+}
+
+// Called with the v5 mutex. Returns nullptr if `topic` has no alias.
+MQTT::TopicAlias* MQTT::AliasOf(const char* topic) {
+    auto entry = aliases_.find(topic);
+    if (entry == aliases_.end()) {
+        if (aliases_.size() >= kMaxAliasCandidates) {
+            return nullptr;
+        }
+        entry = aliases_.emplace(topic, TopicAlias{0, 0, false}).first;
+    }
+    TopicAlias& alias = entry->second;
+    alias.publishes++;
+    if (alias.alias == 0 && alias.publishes >= (uint32_t)alias_min_publishes_ &&
+        next_alias_ <= alias_limit_) {
+        alias.alias = next_alias_++;
+    }
+    return alias.alias != 0 ? &alias : nullptr;
+}
+
+// Hands a message over to the client: publishes it, or with `enqueue` only
+// copies it into the outbox. Returns the msg_id, or -1. `bytes` is the size of
+// the topic and payload actually sent.
+int MQTT::Send(const char* topic,
+               const char* data,
+               int len,
+               int qos,
+               int retain,
+               const Properties* properties,
+               bool enqueue,
+               size_t* bytes) {
+    *bytes = strlen(topic) + len;
+    if (!v5_) {
+        if (enqueue) {
+            return esp_mqtt_client_enqueue(client_, topic, data, len, qos, retain, true);
+        }
+        return esp_mqtt_client_publish(client_, topic, data, len, qos, retain);
+    }
+
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    xSemaphoreTake(v5_mutex_, portMAX_DELAY);
+    esp_mqtt5_publish_property_config_t property = {};
+    if (properties != nullptr) {
+        property.message_expiry_interval = properties->message_expiry_interval;
+        if (!properties->response_topic.empty()) {
+            property.response_topic = properties->response_topic.c_str();
+        }
+        if (!properties->correlation_data.empty()) {
+            property.correlation_data = properties->correlation_data.data();
+            property.correlation_data_len = properties->correlation_data.size();
+        }
+        if (!properties->content_type.empty()) {
+            property.content_type = properties->content_type.c_str();
+        }
+        std::vector<esp_mqtt5_user_property_item_t> items;
+        for (auto& p : properties->user_properties) {
+            items.push_back({p.first.c_str(), p.second.c_str()});
+        }
+        if (!items.empty()) {
+            esp_mqtt5_client_set_user_property(&property.user_property, items.data(), items.size());
+        }
+    }
+
+    // Only QoS 0 messages use aliases: QoS 1/2 messages may be resent on another
+    // connection, where their alias may already stand for another topic
+    TopicAlias* alias = qos == 0 ? AliasOf(topic) : nullptr;
+    const char* sent_topic = topic;
+    if (alias != nullptr) {
+        property.topic_alias = alias->alias;
+        if (alias->announced) {
+            sent_topic = "";
+        }
+    }
+
+    int msg_id = -1;
+    for (int attempt = 0; attempt < 2 && msg_id < 0; attempt++) {
+        esp_mqtt5_client_set_publish_property(client_, &property);
+        if (enqueue) {
+            msg_id = esp_mqtt_client_enqueue(client_, sent_topic, data, len, qos, retain, true);
+        } else {
+            msg_id = esp_mqtt_client_publish(client_, sent_topic, data, len, qos, retain);
+        }
+        if (msg_id >= 0 || alias == nullptr || alias->announced) {
+            break;
+        }
+        // A new alias above the broker's Topic Alias Maximum: retry without it
+        ESP_LOGW(kTag, "Topic alias %u rejected", (unsigned)alias->alias);
+        alias_limit_ = alias->alias - 1;
+        alias->alias = 0;
+        alias = nullptr;
+        property.topic_alias = 0;
+    }
+    if (msg_id >= 0 && alias != nullptr) {
+        alias->announced = true;
+        topic_bytes_saved_ += strlen(topic) - strlen(sent_topic);
+    }
+    esp_mqtt5_client_delete_user_property(property.user_property);
+    xSemaphoreGive(v5_mutex_);
+    *bytes = strlen(sent_topic) + len;
+    return msg_id;
+#else
+    return -1;
+#endif
+}
+
+// Called once the client accepted a message. Without `done`, QoS 1/2 messages
+// are still tracked for the publish metrics.
+void MQTT::TrackAck(int msg_id, size_t bytes, int qos, PublishCallback done, int timeout_ms) {
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+    publish_metrics_.published++;
+    publish_metrics_.bytes_out += bytes;
+    if (qos == 0) {
+        xSemaphoreGive(queue_mutex_);
+        if (done != nullptr) {
+            done(ESP_OK);
+        }
+        return;
+    }
+    for (auto it = early_acks_.begin(); it != early_acks_.end(); it++) {
+        if (*it == msg_id) {
+            early_acks_.erase(it);
+            RecordAck(0);
+            xSemaphoreGive(queue_mutex_);
+            if (done != nullptr) {
+                done(ESP_OK);
+            }
+            return;
+        }
+    }
+    pending_acks_[msg_id] = {done, now, now + timeout_ms * 1000LL};
+    xSemaphoreGive(queue_mutex_);
+}
+
+// Called with the queue mutex
+void MQTT::RecordAck(int64_t latency_us) {
+    uint32_t latency_ms = latency_us / 1000;
+    int bucket = 0;
+    while (bucket < PublishMetrics::kAckLatencyBuckets - 1 &&
+           latency_ms > PublishMetrics::kAckLatencyBoundsMs[bucket]) {
+        bucket++;
+    }
+    publish_metrics_.ack_latency[bucket]++;
+    publish_metrics_.ack_latency_max_ms = std::max(publish_metrics_.ack_latency_max_ms, latency_ms);
+    publish_metrics_.acked++;
+    publish_metrics_.retransmits_estimated += latency_ms / kRetransmitTimeoutMs;
+}
+
+void MQTT::Acknowledge(int msg_id, esp_err_t result) {
+    PublishCallback done;
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+    auto entry = pending_acks_.find(msg_id);
+    if (entry != pending_acks_.end()) {
+        if (result == ESP_OK) {
+            RecordAck(now - entry->second.sent);
+        } else {
+            publish_metrics_.expired++;
+        }
+        done = std::move(entry->second.done);
+        pending_acks_.erase(entry);
+    } else if (result == ESP_OK) {
+        early_acks_.push_back(msg_id);
+        if (early_acks_.size() > kMaxEarlyAcks) {
+            early_acks_.pop_front();
+        }
+    }
+    xSemaphoreGive(queue_mutex_);
+    if (done != nullptr) {
+        done(result);
+    }
+}
+
+void MQTT::ExpireAcks() {
+    std::vector<PublishCallback> expired;
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+    for (auto it = pending_acks_.begin(); it != pending_acks_.end();) {
+        if (now >= it->second.deadline) {
+            publish_metrics_.timed_out++;
+            if (it->second.done != nullptr) {
+                expired.push_back(std::move(it->second.done));
+            }
+            it = pending_acks_.erase(it);
+        } else {
+            it++;
+        }
+    }
+    xSemaphoreGive(queue_mutex_);
+    for (auto& done : expired) {
+        done(ESP_ERR_TIMEOUT);
+    }
+}
+
+MQTT::PublishMetrics MQTT::GetPublishMetrics() {
+    xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+    PublishMetrics metrics = publish_metrics_;
+    metrics.in_flight = pending_acks_.size();
+    metrics.queued = queue_.size();
+    metrics.dropped = dropped_;
+    xSemaphoreGive(queue_mutex_);
+    if (client_ != nullptr) {
+        metrics.outbox_bytes = esp_mqtt_client_get_outbox_size(client_);
+    }
+    xSemaphoreTake(v5_mutex_, portMAX_DELAY);
+    metrics.topic_bytes_saved = topic_bytes_saved_;
+    xSemaphoreGive(v5_mutex_);
+    return metrics;
+}
+
+void MQTT::SetPublishPolicy(const char* filter, PublishPolicy policy) {
+    xSemaphoreTake(topics_mutex_, portMAX_DELAY);
+    publish_policies_.push_back({filter, policy});
+    xSemaphoreGive(topics_mutex_);
+}
+
+// Decides whether the publish policy of `topic` lets this message through. A value
+// changed within the minimum interval is held back and sent once the interval is
+// over, unless a newer value replaces it first. Heartbeats only override the
+// duplicate suppression, not the minimum interval.
+MQTT::PolicyCheck MQTT::Suppress(const char* topic,
+                                 const char* data,
+                                 int len,
+                                 int qos,
+                                 int retain,
+                                 std::shared_ptr<const Properties> properties) {
+    PolicyCheck check;
+    xSemaphoreTake(topics_mutex_, portMAX_DELAY);
+    const PublishPolicy* policy = nullptr;
+    for (auto& p : publish_policies_) {
+        if (TopicTrie::Matches(p.first, topic)) {
+            policy = &p.second;
+            break;
+        }
+    }
+    if (policy == nullptr) {
+        xSemaphoreGive(topics_mutex_);
+        return check;
+    }
+
+    check.tracked = true;
+    check.hash = policy->on_change ? esp_rom_crc32_le(0, (const uint8_t*)data, len) : 0;
+    auto state = topic_states_.find(topic);
+    if (state == topic_states_.end()) {
+        xSemaphoreGive(topics_mutex_);
+        return check;
+    }
+    TopicState& s = state->second;
+    int64_t now = esp_timer_get_time();
+    bool too_soon = now - s.last_publish < policy->min_interval_ms * 1000LL;
+    bool duplicate = policy->on_change && check.hash == s.hash &&
+                     (policy->heartbeat == 0 || s.suppressed < policy->heartbeat);
+    check.suppress = too_soon || duplicate;
+    if (s.held != nullptr) {  // superseded by this message
+        s.held = nullptr;
+        suppressed_++;
+    }
+    if (check.suppress) {
+        s.suppressed++;
+        std::shared_ptr<char> payload;
+        if (too_soon && !duplicate && trailing_timer_ != nullptr) {
+            payload = CopyPayload(data, len);
+        }
+        if (payload != nullptr) {
+            s.held = std::make_shared<QueuedMessage>(QueuedMessage{
+                topic, payload, len, qos, retain, nullptr, kPublishTimeoutMs, properties});
+            s.held_until = s.last_publish + policy->min_interval_ms * 1000LL;
+            ArmOnce(trailing_timer_, &trailing_due_, s.held_until);
+        } else {
+            suppressed_++;
+        }
+    }
+    xSemaphoreGive(topics_mutex_);
+    return check;
+}
+
+// Records a message the client accepted, or queued: the policies compare the next
+// messages with this one
+void MQTT::Published(const char* topic, const PolicyCheck& check) {
+    if (!check.tracked) {
+        return;
+    }
+    xSemaphoreTake(topics_mutex_, portMAX_DELAY);
+    TopicState& s = topic_states_[topic];
+    s.hash = check.hash;
+    s.last_publish = esp_timer_get_time();
+    s.suppressed = 0;
+    xSemaphoreGive(topics_mutex_);
+}
+
+// Arms the one-shot `timer` for `due` unless it fires earlier. `armed` is the time it
+// fires (0: stopped), guarded by the caller's mutex; the callback resets it to 0.
+void MQTT::ArmOnce(esp_timer_handle_t timer, int64_t* armed, int64_t due) {
+    if (timer == nullptr || (*armed != 0 && *armed <= due)) {
+        return;
+    }
+    *armed = due;
+    esp_timer_stop(timer);
+    esp_timer_start_once(timer, std::max<int64_t>(due - esp_timer_get_time(), 0));
+}
+
+// Sends the held values whose minimum interval is over
+void MQTT::SendTrailing() {
+    std::vector<std::shared_ptr<QueuedMessage>> due;
+    int64_t now = esp_timer_get_time();
+    int64_t next = 0;
+    xSemaphoreTake(topics_mutex_, portMAX_DELAY);
+    for (auto& entry : topic_states_) {
+        TopicState& s = entry.second;
+        if (s.held == nullptr) {
+            continue;
+        } else if (s.held_until <= now) {
+            due.push_back(std::move(s.held));
+            s.held = nullptr;
+        } else if (next == 0 || s.held_until < next) {
+            next = s.held_until;
+        }
+    }
+    trailing_due_ = 0;
+    if (next != 0) {
+        ArmOnce(trailing_timer_, &trailing_due_, next);
+    }
+    xSemaphoreGive(topics_mutex_);
+
+    for (auto& m : due) {
+        Submit(m->topic.c_str(),
+               m->data.get(),
+               m->len,
+               m->qos,
+               m->retain,
+               m->properties,
+               nullptr,
+               m->timeout_ms);
+    }
+}
+
+void MQTT::SetQueueLimits(size_t max_messages, size_t max_bytes) {
+    xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+    max_messages_ = max_messages;
+    max_bytes_ = max_bytes;
+    xSemaphoreGive(queue_mutex_);
+}
+
+// The first matching filter applies; the default policy is kDropOldest
+void MQTT::SetDropPolicy(const char* filter, DropPolicy policy) {
+    xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+    policies_.push_back({filter, policy});
+    xSemaphoreGive(queue_mutex_);
+}
+
+void MQTT::SetDrainPacing(int burst, int interval_ms) {
+    drain_burst_ = burst;
+    drain_interval_ms_ = interval_ms;
+}
+
+void MQTT::SetResumeJitter(uint32_t window_ms) { resume_jitter_ms_ = window_ms; }
+
+size_t MQTT::QueuedMessages() {
+    xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+    size_t count = queue_.size();
+    xSemaphoreGive(queue_mutex_);
+    return count;
+}
+
+// Called with the queue mutex held
+MQTT::DropPolicy MQTT::PolicyOf(const char* topic) {
+    for (auto& p : policies_) {
+        if (TopicTrie::Matches(p.first, topic)) {
+            return p.second;
+        }
+    }
+    return DropPolicy::kDropOldest;
+}
+
+esp_err_t MQTT::Enqueue(const char* topic,
+                        const char* data,
+                        int len,
+                        int qos,
+                        int retain,
+                        PublishCallback done,
+                        int timeout_ms,
+                        std::shared_ptr<const Properties> properties) {
+    size_t size = strlen(topic) + len;
+    xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+    bool too_large = size > max_bytes_;
+    if (too_large) {
+        dropped_++;
+    }
+    xSemaphoreGive(queue_mutex_);
+    if (too_large) {
+        ESP_LOGW(kTag, "Message to %s too large for the offline queue", topic);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    std::shared_ptr<char> payload = CopyPayload(data, len);
+    if (payload == nullptr) {
+        xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+        dropped_++;
+        xSemaphoreGive(queue_mutex_);
+        return ESP_ERR_NO_MEM;
+    }
+
+    std::vector<PublishCallback> evicted;
+    xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+    DropPolicy policy = PolicyOf(topic);
+    bool coalesced = false;
+    if (policy == DropPolicy::kCoalesce) {
+        for (auto& m : queue_) {
+            if (m.topic == topic && !m.sending) {
+                queue_bytes_ += len - m.len;
+                if (m.done != nullptr) {
+                    evicted.push_back(std::move(m.done));
+                }
+                m = {topic, payload, len, qos, retain, done, timeout_ms, properties};
+                coalesced = true;
+                break;
+            }
+        }
+    }
+    while (!coalesced && !queue_.empty() &&
+           (queue_.size() >= max_messages_ || queue_bytes_ + size > max_bytes_)) {
+        if (policy == DropPolicy::kDropNewest) {
+            dropped_++;
+            xSemaphoreGive(queue_mutex_);
+            ESP_LOGW(kTag, "Offline queue full, message to %s dropped", topic);
+            return ESP_FAIL;
+        }
+        // The message being sent completes with its own result
+        auto oldest = queue_.begin();
+        if (oldest->sending) {
+            oldest++;
+        }
+        if (oldest == queue_.end()) {
+            break;
+        }
+        queue_bytes_ -= oldest->topic.size() + oldest->len;
+        if (oldest->done != nullptr) {
+            evicted.push_back(std::move(oldest->done));
+        }
+        queue_.erase(oldest);
+        dropped_++;
+    }
+    if (!coalesced) {
+        queue_.push_back({topic, payload, len, qos, retain, done, timeout_ms, properties});
+        queue_bytes_ += size;
+    }
+    xSemaphoreGive(queue_mutex_);
+    for (auto& callback : evicted) {
+        callback(ESP_FAIL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t MQTT::SetReassembly(size_t buffers, size_t max_message_size) {
+    return reassembler_.Configure(buffers, max_message_size);
+}
+
+void MQTT::Reassemble(esp_mqtt_event_handle_t event) {
+    std::shared_ptr<char> message;
+    if (reassembler_.Add(std::string_view(event->topic, event->topic_len),
+                         event->data,
+                         event->data_len,
+                         event->current_data_offset,
+                         event->total_data_len,
+                         &message)) {
+        Deliver(reassembler_.Topic(),
+                std::string_view(message.get(), event->total_data_len),
+                message);
+    }
+}
+
+// Sends the queued messages, `drain_burst_` at a time, every `drain_interval_ms_`
+void MQTT::DrainTask() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // A fleet reconnecting after a broker restart resubscribes and drains
+        // spread over the window, not all at once
+        if (resume_jitter_ms_ > 0) {
+            vTaskDelay(pdMS_TO_TICKS(esp_random() % resume_jitter_ms_));
+        }
+        xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+        bool session_present = session_present_;
+        xSemaphoreGive(queue_mutex_);
+        if (IsConnected()) {
+            Subscribe(session_present);
+        }
+
+        int sent = 0;
+        int failures = 0;
+        while (IsConnected()) {
+            if (sent >= drain_burst_ || esp_mqtt_client_get_outbox_size(client_) > kMaxOutboxSize) {
+                vTaskDelay(pdMS_TO_TICKS(drain_interval_ms_));
+                sent = 0;
+                continue;
+            }
+
+            xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+            if (queue_.empty()) {
+                draining_ = false;
+                xSemaphoreGive(queue_mutex_);
+                break;
+            }
+            draining_ = true;
+            queue_.front().sending = true;
+            QueuedMessage m = queue_.front();
+            xSemaphoreGive(queue_mutex_);
+
+            size_t bytes;
+            int msg_id = Send(m.topic.c_str(),
+                              m.data.get(),
+                              m.len,
+                              m.qos,
+                              m.retain,
+                              m.properties.get(),
+                              false,
+                              &bytes);
+            if (msg_id < 0 && !IsConnected()) {
+                break;  // keep it for the next connection
+            } else if (msg_id < 0 && ++failures < kMaxSendAttempts) {
+                vTaskDelay(pdMS_TO_TICKS(drain_interval_ms_));
+                continue;
+            }
+            // Sent, or rejected while connected: a message the client keeps
+            // refusing must not hold up the rest of the queue.
+            failures = 0;
+            xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+            queue_bytes_ -= m.topic.size() + m.len;
+            queue_.pop_front();  // marked as sending: neither coalesced nor evicted
+            if (msg_id < 0) {
+                dropped_++;
+            }
+            xSemaphoreGive(queue_mutex_);
+            if (msg_id < 0) {
+                ESP_LOGW(kTag, "Message to %s rejected, dropped", m.topic.c_str());
+                if (m.done != nullptr) {
+                    m.done(ESP_FAIL);
+                }
+                continue;
+            }
+            TrackAck(msg_id, bytes, m.qos, m.done, m.timeout_ms);
+            sent++;
+        }
+        xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+        draining_ = false;
+        if (!queue_.empty()) {
+            queue_.front().sending = false;  // disconnected: not sent
+        }
+        xSemaphoreGive(queue_mutex_);
+    }
 }
 
 void MQTT::EventHandler(esp_event_base_t event_base, int32_t event_id, void* event_data) {
     esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)event_data;
-    esp_mqtt_client_handle_t client = event->client;
 
     switch ((esp_mqtt_event_id_t)event_id) {
+        case MQTT_EVENT_BEFORE_CONNECT:
+            attempt_start_ = esp_timer_get_time();
+            SetState(State::kConnecting);
+            break;
         case MQTT_EVENT_CONNECTED:
-            connected_ = true;
             ESP_LOGI(kTag, "MQTT_EVENT_CONNECTED");
-            for (auto& s : subscriptions_) {
-                const char* filter = s.topic.c_str();
-                ESP_LOGI(kTag, "- Subscribing to %s", filter);
-                esp_mqtt_client_subscribe(client, filter, s.qos);
+            SetState(State::kConnected);
+            ResetTopicAliases();
+            if (drain_task_ != nullptr) {
+                // Until the drain task has resubscribed and drained the queue, new
+                // messages are queued: responses are not missed and order is kept
+                xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+                session_present_ = event->session_present != 0;
+                draining_ = true;
+                xSemaphoreGive(queue_mutex_);
+                xTaskNotifyGive(drain_task_);
+            } else {
+                Subscribe(event->session_present != 0);
             }
             break;
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(kTag, "MQTT_EVENT_DISCONNECTED");
-            connected_ = false;
+            ScheduleReconnect();
             break;
         case MQTT_EVENT_DATA:
             ESP_LOGD(kTag, "MQTT_EVENT_DATA");
             ESP_LOGD(kTag, "- TOPIC=%.*s\r\n", event->topic_len, event->topic);
             ESP_LOGD(kTag, "- DATA=%.*s\r\n", event->data_len, event->data);
+            xSemaphoreTake(queue_mutex_, portMAX_DELAY);
+            publish_metrics_.bytes_in += event->data_len;
+            if (event->current_data_offset == 0) {
+                publish_metrics_.bytes_in += event->topic_len;
+                publish_metrics_.messages_in++;
+            }
+            xSemaphoreGive(queue_mutex_);
+            if (event->current_data_offset != 0 || event->data_len != event->total_data_len) {
+                Reassemble(event);
+            } else {
+                Deliver(std::string_view(event->topic, event->topic_len),
+                        std::string_view(event->data, event->data_len),
+                        nullptr,
+                        event);
+            }
             break;
         case MQTT_EVENT_PUBLISHED:
+            Acknowledge(event->msg_id, ESP_OK);
+            break;
+        case MQTT_EVENT_DELETED:  // expired in the outbox
+            Acknowledge(event->msg_id, ESP_FAIL);
             break;
         case MQTT_EVENT_ERROR:
             ESP_LOGI(kTag, "MQTT_EVENT_ERROR");
+            xSemaphoreTake(state_mutex_, portMAX_DELAY);
+            if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
+                metrics_.transport_errors++;
+                metrics_.last_errno = event->error_handle->esp_transport_sock_errno;
+            } else if (event->error_handle->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
+                metrics_.refused++;
+                metrics_.last_refused_code = event->error_handle->connect_return_code;
+            }
+            xSemaphoreGive(state_mutex_);
             if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
                 LogErrorIfNonZero("reported from esp-tls",
                                   event->error_handle->esp_tls_last_esp_err);
@@ -0,0 +1,235 @@
+/**
+ ******************************************************************************
+ * @file        : mqtt_inbound.cpp
+ * @brief       : MQTT inbound messages
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Passes the received messages to the subscription handlers,
+ *                on the MQTT task or, with SetInboundWorkers(), through one
+ *                bounded queue per worker task. A topic always goes to the
+ *                same worker, which keeps its messages in order.
+ ******************************************************************************
+ */
+
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "mqtt.hpp"
+#include "sdkconfig.h"
+
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+#include <esp_heap_caps.h>
+#endif
+#ifdef CONFIG_MQTT_PROTOCOL_5
+#include <mqtt5_client.h>
+#endif
+
+static const char* kTag = "mqtt inbound";
+
+// Message being dispatched by the current task, see MessageProperties()
+static thread_local esp_mqtt_event_handle_t dispatching_event = nullptr;
+static thread_local const MQTT::Properties* dispatching_properties = nullptr;
+
+void MQTT::SetInboundWorkers(int workers,
+                             size_t max_messages,
+                             size_t max_bytes,
+                             uint32_t stack_size,
+                             UBaseType_t priority) {
+    inbound_worker_count_ = workers;
+    inbound_max_messages_ = max_messages;
+    inbound_max_bytes_ = max_bytes;
+    inbound_stack_size_ = stack_size;
+    inbound_priority_ = priority;
+}
+
+void MQTT::StartInboundWorkers() {
+    while ((int)inbound_workers_.size() < inbound_worker_count_) {
+        char name[16];
+        snprintf(name, sizeof(name), "mqtt_in_%d", (int)inbound_workers_.size());
+        std::unique_ptr<InboundWorker> worker(new InboundWorker{this, nullptr, {}});
+        if (xTaskCreate(InboundWorkerForwarder,
+                        name,
+                        inbound_stack_size_,
+                        worker.get(),
+                        inbound_priority_,
+                        &worker->task) != pdPASS) {
+            ESP_LOGE(kTag, "Failed to create %s", name);
+            break;
+        }
+        xSemaphoreTake(inbound_mutex_, portMAX_DELAY);
+        inbound_workers_.push_back(std::move(worker));
+        xSemaphoreGive(inbound_mutex_);
+    }
+}
+
+void MQTT::Dispatch(std::string_view topic,
+                    std::string_view payload,
+                    esp_mqtt_event_handle_t event,
+                    const Properties* properties) {
+    dispatching_event = event;
+    dispatching_properties = properties;
+    handlers_.Dispatch(topic, payload);
+    if (!prefixed_handlers_.Empty()) {
+        xSemaphoreTake(topics_mutex_, portMAX_DELAY);
+        size_t base = topic_base_.size();
+        bool prefixed = topic.substr(0, base) == topic_base_;
+        xSemaphoreGive(topics_mutex_);
+        if (prefixed) {
+            prefixed_handlers_.Dispatch(topic, payload, base);
+        }
+    }
+    dispatching_event = nullptr;
+    dispatching_properties = nullptr;
+}
+
+// Called on the MQTT task. `buffer` holds `payload` if it outlives the event
+// (reassembled messages), else nullptr.
+void MQTT::Deliver(std::string_view topic,
+                   std::string_view payload,
+                   std::shared_ptr<char> buffer,
+                   esp_mqtt_event_handle_t event) {
+    if (inbound_workers_.empty()) {
+        Dispatch(topic, payload, event, nullptr);
+        return;
+    }
+
+    InboundWorker* worker =
+        inbound_workers_[std::hash<std::string_view>()(topic) % inbound_workers_.size()].get();
+    size_t size = topic.size() + payload.size();
+    xSemaphoreTake(inbound_mutex_, portMAX_DELAY);
+    bool full = inbound_metrics_.depth >= inbound_max_messages_ ||
+                inbound_metrics_.bytes + size > inbound_max_bytes_;
+    if (full) {
+        inbound_metrics_.dropped++;
+    }
+    xSemaphoreGive(inbound_mutex_);
+    if (full) {
+        ESP_LOGW(kTag,
+                 "Inbound queue full, message on %.*s dropped",
+                 (int)topic.size(),
+                 topic.data());
+        return;
+    }
+
+    if (buffer == nullptr) {
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+        buffer = std::shared_ptr<char>(
+            (char*)heap_caps_malloc(payload.size() + 1, MALLOC_CAP_SPIRAM), heap_caps_free);
+#else
+        buffer = std::shared_ptr<char>((char*)malloc(payload.size() + 1), free);
+#endif
+        if (buffer == nullptr) {
+            xSemaphoreTake(inbound_mutex_, portMAX_DELAY);
+            inbound_metrics_.dropped++;
+            xSemaphoreGive(inbound_mutex_);
+            return;
+        }
+        memcpy(buffer.get(), payload.data(), payload.size());
+    }
+    std::shared_ptr<Properties> properties;
+    if (v5_ && event != nullptr) {
+        properties = std::make_shared<Properties>();
+        if (!ReadProperties(event, properties.get())) {
+            properties = nullptr;
+        }
+    }
+
+    xSemaphoreTake(inbound_mutex_, portMAX_DELAY);
+    worker->queue.push_back({std::string(topic), buffer, (int)payload.size(), properties});
+    inbound_metrics_.received++;
+    inbound_metrics_.depth++;
+    inbound_metrics_.max_depth = std::max(inbound_metrics_.max_depth, inbound_metrics_.depth);
+    inbound_metrics_.bytes += size;
+    xSemaphoreGive(inbound_mutex_);
+    xTaskNotifyGive(worker->task);
+}
+
+void MQTT::InboundTask(InboundWorker* worker) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (true) {
+            xSemaphoreTake(inbound_mutex_, portMAX_DELAY);
+            if (worker->queue.empty()) {
+                xSemaphoreGive(inbound_mutex_);
+                break;
+            }
+            InboundMessage m = std::move(worker->queue.front());
+            worker->queue.pop_front();
+            xSemaphoreGive(inbound_mutex_);
+
+            Dispatch(m.topic, std::string_view(m.data.get(), m.len), nullptr, m.properties.get());
+
+            // Counted once handled, so that the byte limit covers the messages in use
+            xSemaphoreTake(inbound_mutex_, portMAX_DELAY);
+            inbound_metrics_.processed++;
+            inbound_metrics_.depth--;
+            inbound_metrics_.bytes -= m.topic.size() + m.len;
+            xSemaphoreGive(inbound_mutex_);
+        }
+    }
+}
+
+MQTT::InboundMetrics MQTT::GetInboundMetrics() {
+    xSemaphoreTake(inbound_mutex_, portMAX_DELAY);
+    InboundMetrics metrics = inbound_metrics_;
+    xSemaphoreGive(inbound_mutex_);
+    return metrics;
+}
+
+bool MQTT::MessageProperties(Properties* properties) {
+    if (dispatching_properties != nullptr) {
+        *properties = *dispatching_properties;
+        return true;
+    }
+    *properties = {};
+    return dispatching_event != nullptr && ReadProperties(dispatching_event, properties);
+}
+
+bool MQTT::ReadProperties(esp_mqtt_event_handle_t event, Properties* properties) {
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    const esp_mqtt5_event_property_t* property = event->property;
+    if (property == nullptr) {
+        return false;
+    }
+    if (property->response_topic != nullptr) {
+        properties->response_topic.assign(property->response_topic, property->response_topic_len);
+    }
+    if (property->correlation_data != nullptr) {
+        properties->correlation_data.assign(property->correlation_data,
+                                            property->correlation_data_len);
+    }
+    if (property->content_type != nullptr) {
+        properties->content_type.assign(property->content_type, property->content_type_len);
+    }
+    uint8_t count = property->user_property != nullptr
+                        ? esp_mqtt5_client_get_user_property_count(property->user_property)
+                        : 0;
+    if (count > 0) {
+        std::vector<esp_mqtt5_user_property_item_t> items(count);
+        if (esp_mqtt5_client_get_user_property(property->user_property, items.data(), &count) ==
+            ESP_OK) {
+            for (int i = 0; i < count; i++) {
+                properties->user_properties.push_back({items[i].key, items[i].value});
+                free((char*)items[i].key);  // copies allocated by esp-mqtt
+                free((char*)items[i].value);
+            }
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
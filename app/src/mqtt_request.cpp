@@ -0,0 +1,191 @@
+/**
+ ******************************************************************************
+ * @file        : mqtt_request.cpp
+ * @brief       : MQTT request/response client
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Requests are published with QoS 1 and answered on a topic
+ *                of their own, "<topic-base>response/<id>" with <id> in hex,
+ *                so that any number of requests can be in flight and each
+ *                response is matched with one hash lookup. With MQTT 5, the
+ *                topic and the id go in the response topic and correlation
+ *                data properties; otherwise the request payload names the
+ *                response topic.
+ ******************************************************************************
+ */
+
+#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "mqtt.hpp"
+
+static const char* kTag = "mqtt request";
+
+void MQTT::EnableRequests(const char* prefix, size_t max_pending) {
+    response_prefix_ = prefix;
+    if (response_prefix_.empty() || response_prefix_.back() != '/') {
+        response_prefix_ += '/';
+    }
+    max_pending_requests_ = max_pending;
+    next_request_id_ = esp_random();  // not to match the responses to a previous boot
+    AddSubscription(
+        (response_prefix_ + "+").c_str(),
+        1,
+        [this](std::string_view topic, std::string_view payload) {
+            HandleResponse(topic, payload);
+        },
+        true);
+}
+
+uint32_t MQTT::NextRequestId() {
+    xSemaphoreTake(requests_mutex_, portMAX_DELAY);
+    uint32_t id = next_request_id_++;
+    xSemaphoreGive(requests_mutex_);
+    return id;
+}
+
+std::string MQTT::ResponseTopic(uint32_t id) {
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%08lx", (unsigned long)id);
+    return Prefixed((response_prefix_ + hex).c_str());
+}
+
+esp_err_t MQTT::Request(
+    const char* topic, const char* data, int len, ResponseCallback done, int timeout_ms) {
+    if (response_prefix_.empty()) {
+        ESP_LOGE(kTag, "Requests not enabled");
+        return ESP_ERR_INVALID_STATE;
+    }
+    return SendRequest(NextRequestId(), topic, data, len, done, timeout_ms);
+}
+
+esp_err_t MQTT::Request(const char* topic,
+                        RequestBuilder build,
+                        ResponseCallback done,
+                        int timeout_ms) {
+    if (response_prefix_.empty()) {
+        ESP_LOGE(kTag, "Requests not enabled");
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint32_t id = NextRequestId();
+    std::string payload = build(ResponseTopic(id));
+    return SendRequest(id, topic, payload.data(), payload.size(), done, timeout_ms);
+}
+
+esp_err_t MQTT::SendRequest(uint32_t id,
+                            const char* topic,
+                            const char* data,
+                            int len,
+                            ResponseCallback done,
+                            int timeout_ms) {
+    xSemaphoreTake(requests_mutex_, portMAX_DELAY);
+    if (requests_.size() >= max_pending_requests_) {
+        xSemaphoreGive(requests_mutex_);
+        ESP_LOGW(kTag, "Too many requests in flight");
+        return ESP_ERR_NO_MEM;
+    }
+    int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+    requests_[id] = {done, deadline};
+    ArmOnce(request_timer_, &request_due_, deadline);
+    xSemaphoreGive(requests_mutex_);
+
+    std::shared_ptr<Properties> properties;
+    if (v5_) {
+        properties = std::make_shared<Properties>();
+        properties->response_topic = ResponseTopic(id);
+        properties->correlation_data =
+            properties->response_topic.substr(properties->response_topic.rfind('/') + 1);
+    }
+    // A suppressed request would only be answered by its timeout
+    esp_err_t err = Submit(
+        topic,
+        data,
+        len,
+        1,
+        0,
+        properties,
+        [this, id](esp_err_t result) {
+            if (result != ESP_OK) {
+                CompleteRequest(id, result, {});
+            }
+        },
+        timeout_ms,
+        false);
+    if (err != ESP_OK) {
+        xSemaphoreTake(requests_mutex_, portMAX_DELAY);
+        requests_.erase(id);
+        xSemaphoreGive(requests_mutex_);
+    }
+    return err;
+}
+
+void MQTT::HandleResponse(std::string_view topic, std::string_view payload) {
+    std::string hex(topic.substr(topic.rfind('/') + 1));  // the "+" level
+    char* end;
+    uint32_t id = strtoul(hex.c_str(), &end, 16);
+    if (hex.empty() || *end != '\0') {
+        ESP_LOGW(kTag, "Unexpected response topic %.*s", (int)topic.size(), topic.data());
+        return;
+    }
+    CompleteRequest(id, ESP_OK, payload);
+}
+
+// Runs `done` at most once: responses after a timeout are ignored
+void MQTT::CompleteRequest(uint32_t id, esp_err_t result, std::string_view payload) {
+    ResponseCallback done;
+    xSemaphoreTake(requests_mutex_, portMAX_DELAY);
+    auto entry = requests_.find(id);
+    if (entry != requests_.end()) {
+        done = std::move(entry->second.done);
+        requests_.erase(entry);
+    }
+    xSemaphoreGive(requests_mutex_);
+    if (done != nullptr) {
+        done(result, payload);
+    } else {
+        ESP_LOGD(kTag, "Late or unknown response %08lx", (unsigned long)id);
+    }
+}
+
+// Runs at the earliest deadline, then arms the timer for the next one
+void MQTT::ExpireRequests() {
+    std::vector<ResponseCallback> expired;
+    int64_t now = esp_timer_get_time();
+    int64_t next = 0;
+    xSemaphoreTake(requests_mutex_, portMAX_DELAY);
+    for (auto it = requests_.begin(); it != requests_.end();) {
+        if (now >= it->second.deadline) {
+            expired.push_back(std::move(it->second.done));
+            it = requests_.erase(it);
+        } else {
+            if (next == 0 || it->second.deadline < next) {
+                next = it->second.deadline;
+            }
+            it++;
+        }
+    }
+    request_due_ = 0;
+    if (next != 0) {
+        ArmOnce(request_timer_, &request_due_, next);
+    }
+    xSemaphoreGive(requests_mutex_);
+    for (auto& done : expired) {
+        done(ESP_ERR_TIMEOUT, {});
+    }
+}
+
+size_t MQTT::PendingRequests() {
+    xSemaphoreTake(requests_mutex_, portMAX_DELAY);
+    size_t count = requests_.size();
+    xSemaphoreGive(requests_mutex_);
+    return count;
+}
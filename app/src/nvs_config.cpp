@@ -14,72 +14,84 @@
 
 #include "nvs_config.hpp"
 
+#include <esp_log.h>
+#include <inttypes.h>
 #include <mbedtls/base64.h>
+#include <nvs_flash.h>
 #include <string.h>
 
-NvsHandle::NvsHandle() : handle_(0) {}
-NvsHandle::~NvsHandle() { Close(); }
+#include <map>
+#include <memory>
+#include <string>
 
-esp_err_t NvsHandle::Open(const char* name_space, nvs_open_mode_t mode) {
-    return nvs_open(name_space, mode, &handle_);
-}
-void NvsHandle::Close() {
-    if (handle_ != 0) {
-        nvs_close(handle_);
-    }
-}
+#include "config_bundle.hpp"
+#include "config_hash.hpp"
+#include "config_profiles.hpp"
+#include "sdkconfig.h"
 
-esp_err_t NvsHandle::FindKey(const char* key, nvs_type_t* out_type) {
-    return nvs_find_key(handle_, key, out_type);
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+#include <esp_heap_caps.h>
+#endif
+
+static const char* kTag = "nvs config";
+
+static esp_err_t Fail(const char** error, const char* message, esp_err_t err = ESP_FAIL) {
+    if (error != nullptr) {
+        *error = message;
+    }
+    return err;
 }
 
-esp_err_t NvsHandle::GetInt(const char* key, nvs_type_t type, double* value) {
+static esp_err_t GetNvsInt(nvs_handle_t handle,
+                           const char* key,
+                           nvs_type_t type,
+                           double* value) {
     switch (type) {
         case NVS_TYPE_U8: {
             uint8_t u8;
-            esp_err_t err = nvs_get_u8(handle_, key, &u8);
+            esp_err_t err = nvs_get_u8(handle, key, &u8);
             *value = u8;
             return err;
         }
         case NVS_TYPE_I8: {
             int8_t i8;
-            esp_err_t err = nvs_get_i8(handle_, key, &i8);
+            esp_err_t err = nvs_get_i8(handle, key, &i8);
             *value = i8;
             return err;
         }
         case NVS_TYPE_U16: {
             uint16_t u16;
-            esp_err_t err = nvs_get_u16(handle_, key, &u16);
+            esp_err_t err = nvs_get_u16(handle, key, &u16);
             *value = u16;
             return err;
         }
         case NVS_TYPE_I16: {
             int16_t i16;
-            esp_err_t err = nvs_get_i16(handle_, key, &i16);
+            esp_err_t err = nvs_get_i16(handle, key, &i16);
             *value = i16;
             return err;
         }
         case NVS_TYPE_U32: {
             uint32_t u32;
-            esp_err_t err = nvs_get_u32(handle_, key, &u32);
+            esp_err_t err = nvs_get_u32(handle, key, &u32);
             *value = u32;
             return err;
         }
         case NVS_TYPE_I32: {
             int32_t i32;
-            esp_err_t err = nvs_get_i32(handle_, key, &i32);
+            esp_err_t err = nvs_get_i32(handle, key, &i32);
             *value = i32;
             return err;
         }
         case NVS_TYPE_U64: {
             uint64_t u64;
-            esp_err_t err = nvs_get_u64(handle_, key, &u64);
+            esp_err_t err = nvs_get_u64(handle, key, &u64);
             *value = u64;
             return err;
         }
         case NVS_TYPE_I64: {
             int64_t i64;
-            esp_err_t err = nvs_get_i64(handle_, key, &i64);
+            esp_err_t err = nvs_get_i64(handle, key, &i64);
             *value = i64;
             return err;
         }
@@ -88,46 +100,288 @@ esp_err_t NvsHandle::GetInt(const char* key, nvs_type_t type, double* value) {
     }
 }
 
+std::vector<std::string> NvsHandle::partitions_ = {NVS_DEFAULT_PART_NAME};
+std::map<std::string, std::string> NvsHandle::routes_;
+std::map<std::string, std::string> NvsHandle::aliases_;
+std::vector<std::string> NvsHandle::hidden_;
+
+NvsHandle::NvsHandle() : handle_(0), name_space_{0}, physical_{0} {}
+NvsHandle::~NvsHandle() { Close(); }
+
+esp_err_t NvsHandle::InitPartition(const char* partition) {
+    esp_err_t err = nvs_flash_init_partition(partition);
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_LOGW(kTag, "Erasing NVS partition '%s'", partition);
+        err = nvs_flash_erase_partition(partition);
+        if (err == ESP_OK) {
+            err = nvs_flash_init_partition(partition);
+        }
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    for (auto& p : partitions_) {
+        if (p == partition) {
+            return ESP_OK;
+        }
+    }
+    partitions_.push_back(partition);
+    return ESP_OK;
+}
+
+void NvsHandle::RouteNameSpace(const char* name_space, const char* partition) {
+    routes_[name_space] = partition;
+}
+
+const char* NvsHandle::PartitionOf(const char* name_space) {
+    auto route = routes_.find(name_space);
+    if (route != routes_.end()) {
+        for (auto& p : partitions_) {
+            if (p == route->second) {
+                return p.c_str();
+            }
+        }
+        ESP_LOGW(kTag,
+                 "Partition '%s' not initialized, '%s' stays in '%s'",
+                 route->second.c_str(),
+                 name_space,
+                 NVS_DEFAULT_PART_NAME);
+    }
+    return NVS_DEFAULT_PART_NAME;
+}
+
+void NvsHandle::AliasNameSpace(const char* name_space, const char* target) {
+    aliases_[name_space] = target;
+}
+
+void NvsHandle::HideNameSpace(const char* name_space) {
+    for (auto& h : hidden_) {
+        if (h == name_space) {
+            return;
+        }
+    }
+    hidden_.push_back(name_space);
+}
+
+// Returns the name under which a physical namespace is reported, or nullptr if hidden
+const char* NvsHandle::LogicalNameSpace(const char* physical) {
+    for (auto& alias : aliases_) {
+        if (alias.second == physical) {
+            return alias.first.c_str();
+        }
+    }
+    for (auto& h : hidden_) {
+        if (h == physical) {
+            return nullptr;
+        }
+    }
+    return physical;
+}
+
+const char* NvsHandle::PhysicalNameSpace(const char* name_space) {
+    auto alias = aliases_.find(name_space);
+    return alias == aliases_.end() ? name_space : alias->second.c_str();
+}
+
+esp_err_t NvsHandle::Open(const char* name_space, nvs_open_mode_t mode) {
+    if (aliases_.empty()) {
+        return Open(name_space, mode, PartitionOf(name_space));
+    }
+    auto alias = aliases_.find(name_space);
+    if (alias == aliases_.end()) {
+        return Open(name_space, mode, PartitionOf(name_space));
+    }
+    esp_err_t err = Open(alias->second.c_str(), mode, PartitionOf(name_space));
+    strlcpy(name_space_, name_space, sizeof(name_space_));
+    return err;
+}
+
+esp_err_t NvsHandle::Open(const char* name_space, nvs_open_mode_t mode, const char* partition) {
+    strlcpy(name_space_, name_space, sizeof(name_space_));
+    strlcpy(physical_, name_space, sizeof(physical_));
+    return nvs_open_from_partition(partition, name_space, mode, &handle_);
+}
+void NvsHandle::Close() {
+    if (handle_ != 0) {
+        nvs_close(handle_);
+        handle_ = 0;
+    }
+}
+
+esp_err_t NvsHandle::FindKey(const char* key, nvs_type_t* out_type) {
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    if (handle_ != 0) {
+        err = nvs_find_key(handle_, key, out_type);
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ConfigBundle* bundle = ConfigBundle::GetInstance();
+        bundle->Lock();
+        const ConfigBundle::Entry* entry = bundle->Find(name_space_, key);
+        if (entry != nullptr) {
+            *out_type = (nvs_type_t)entry->type;
+            err = ESP_OK;
+        }
+        bundle->Unlock();
+    }
+    return err;
+}
+
+// Values missing from NVS (or from a namespace that does not exist in NVS) are
+// looked up in the configuration bundle, if one is mounted.
+esp_err_t NvsHandle::GetFromBundle(const char* key,
+                                   nvs_type_t type,
+                                   void* value,
+                                   size_t* length) {
+    ConfigBundle* bundle = ConfigBundle::GetInstance();
+    nvs_type_t bundle_type;
+    const void* data;
+    size_t size;
+    bundle->Lock();
+    esp_err_t err = bundle->Get(name_space_, key, &bundle_type, &data, &size);
+    if (err != ESP_OK) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (bundle_type != type) {
+        err = ESP_ERR_NVS_TYPE_MISMATCH;
+    } else if (value != nullptr && *length < size) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else if (value != nullptr) {
+        memcpy(value, data, size);
+    }
+    bundle->Unlock();
+    if (err == ESP_OK || err == ESP_ERR_NVS_INVALID_LENGTH) {
+        *length = size;
+    }
+    return err;
+}
+
+esp_err_t NvsHandle::GetInt(const char* key, nvs_type_t type, double* value) {
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    if (handle_ != 0) {
+        err = GetNvsInt(handle_, key, type, value);
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ConfigBundle* bundle = ConfigBundle::GetInstance();
+        bundle->Lock();
+        const ConfigBundle::Entry* entry = bundle->Find(name_space_, key);
+        if (entry == nullptr) {
+            err = ESP_ERR_NVS_NOT_FOUND;
+        } else if (entry->type != type) {
+            err = ESP_ERR_NVS_TYPE_MISMATCH;
+        } else {
+            err = bundle->GetInt(name_space_, key, value);
+        }
+        bundle->Unlock();
+    }
+    return err;
+}
+
 esp_err_t NvsHandle::GetString(const char* key, char* value, size_t* length) {
-    return nvs_get_str(handle_, key, value, length);
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    if (handle_ != 0) {
+        err = nvs_get_str(handle_, key, value, length);
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = GetFromBundle(key, NVS_TYPE_STR, value, length);
+    }
+    return err;
+}
+
+// Strings of any length, in a single lookup for the common (short) case. On a too
+// small buffer, NVS reports the required length and the read is retried once.
+esp_err_t NvsHandle::GetString(const char* key, std::string* value) {
+    char buffer[96];
+    size_t length = sizeof(buffer);
+    esp_err_t err = GetString(key, buffer, &length);
+    if (err == ESP_OK) {
+        value->assign(buffer, length > 0 ? length - 1 : 0);
+    } else if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+        std::string result(length, '\0');
+        err = GetString(key, result.data(), &length);
+        if (err == ESP_OK) {
+            result.resize(length - 1);
+            *value = std::move(result);
+        }
+    }
+    return err;
 }
 
 esp_err_t NvsHandle::GetBlob(const char* key, void* value, size_t* length) {
-    return nvs_get_blob(handle_, key, value, length);
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    if (handle_ != 0) {
+        err = nvs_get_blob(handle_, key, value, length);
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = GetFromBundle(key, NVS_TYPE_BLOB, value, length);
+    }
+    return err;
 }
 
 esp_err_t NvsHandle::SetInt(const char* key, nvs_type_t type, double value) {
+    esp_err_t err;
     switch (type) {
         case NVS_TYPE_U8:
-            return nvs_set_u8(handle_, key, value);
+            err = nvs_set_u8(handle_, key, value);
+            break;
         case NVS_TYPE_I8:
-            return nvs_set_i8(handle_, key, value);
+            err = nvs_set_i8(handle_, key, value);
+            break;
         case NVS_TYPE_U16:
-            return nvs_set_u16(handle_, key, value);
+            err = nvs_set_u16(handle_, key, value);
+            break;
         case NVS_TYPE_I16:
-            return nvs_set_i16(handle_, key, value);
+            err = nvs_set_i16(handle_, key, value);
+            break;
         case NVS_TYPE_U32:
-            return nvs_set_u32(handle_, key, value);
+            err = nvs_set_u32(handle_, key, value);
+            break;
         case NVS_TYPE_I32:
-            return nvs_set_i32(handle_, key, value);
+            err = nvs_set_i32(handle_, key, value);
+            break;
         case NVS_TYPE_U64:
-            return nvs_set_u64(handle_, key, value);
+            err = nvs_set_u64(handle_, key, value);
+            break;
         case NVS_TYPE_I64:
-            return nvs_set_i64(handle_, key, value);
+            err = nvs_set_i64(handle_, key, value);
+            break;
         default:
             return ESP_ERR_NVS_TYPE_MISMATCH;
     }
+    if (err == ESP_OK) {
+        ConfigHash::Set(physical_, key, ConfigHash::OfInt(key, type, value));
+    }
+    return err;
 }
 esp_err_t NvsHandle::SetString(const char* key, const char* value) {
-    return nvs_set_str(handle_, key, value);
+    esp_err_t err = nvs_set_str(handle_, key, value);
+    if (err == ESP_OK) {
+        ConfigHash::Set(
+            physical_, key, ConfigHash::Of(key, NVS_TYPE_STR, value, strlen(value) + 1));
+    }
+    return err;
 }
 esp_err_t NvsHandle::SetBlob(const char* key, const void* value, size_t length) {
-    return nvs_set_blob(handle_, key, value, length);
+    esp_err_t err = nvs_set_blob(handle_, key, value, length);
+    if (err == ESP_OK) {
+        ConfigHash::Set(physical_, key, ConfigHash::Of(key, NVS_TYPE_BLOB, value, length));
+    }
+    return err;
 }
 
 esp_err_t NvsHandle::Commit() { return nvs_commit(handle_); }
-esp_err_t NvsHandle::EraseKey(const char* key) { return nvs_erase_key(handle_, key); }
-esp_err_t NvsHandle::EraseAll() { return nvs_erase_all(handle_); }
+esp_err_t NvsHandle::EraseKey(const char* key) {
+    esp_err_t err = nvs_erase_key(handle_, key);
+    if (err == ESP_OK) {
+        ConfigHash::Erase(physical_, key);
+    }
+    return err;
+}
+esp_err_t NvsHandle::EraseAll() {
+    esp_err_t err = nvs_erase_all(handle_);
+    if (err == ESP_OK) {
+        ConfigHash::Clear(physical_);
+    }
+    return err;
+}
 
 // ----- Static Methods -----
 
@@ -213,3 +467,383 @@ int NvsHandle::Base64Encode(char* dst, size_t dlen, size_t* olen, const char* sr
 int NvsHandle::Base64Decode(char* dst, size_t dlen, size_t* olen, const char* src, size_t slen) {
     return mbedtls_base64_decode((unsigned char*)dst, dlen, olen, (const unsigned char*)src, slen);
 }
+
+// ----- Configuration Services -----
+
+// Changes to a namespace protected by a configuration profile go to its staging slot,
+// and only take effect once the profile is activated: `staged` is then set.
+static esp_err_t OpenForWrite(NvsHandle& handle,
+                              const char* name_space,
+                              bool* staged,
+                              const char** error) {
+    ConfigProfiles* profiles = ConfigProfiles::GetInstance();
+    *staged = profiles->IsProtected(name_space);
+    if (!*staged) {
+        if (handle.Open(name_space, NVS_READWRITE) != ESP_OK) {
+            return Fail(error, "Failed to open NVS handle");
+        }
+        return ESP_OK;
+    }
+
+    std::string staging;
+    esp_err_t err = profiles->Stage(name_space, &staging);
+    if (err == ESP_ERR_INVALID_STATE) {
+        return Fail(error, "Configuration profile pending verification", err);
+    } else if (err != ESP_OK) {
+        return Fail(error, "Failed to stage configuration profile", err);
+    }
+    if (handle.Open(staging.c_str(), NVS_READWRITE, NvsHandle::PartitionOf(name_space)) !=
+        ESP_OK) {
+        return Fail(error, "Failed to open NVS handle");
+    }
+    return ESP_OK;
+}
+
+esp_err_t NvsConfig::ToJson(NvsHandle& handle,
+                            const char* key,
+                            nvs_type_t nvs_type,
+                            cJSON* node,
+                            const char** error) {
+    char typeName[16];
+    if (NvsHandle::TypeName(nvs_type, typeName, sizeof(typeName)) != ESP_OK) {
+        return Fail(error, "Failed to get type");
+    }
+
+    cJSON_AddStringToObject(node, "type", typeName);
+
+    switch (nvs_type) {
+        case NVS_TYPE_I8:
+        case NVS_TYPE_U8:
+        case NVS_TYPE_I16:
+        case NVS_TYPE_U16:
+        case NVS_TYPE_I32:
+        case NVS_TYPE_U32:
+        case NVS_TYPE_I64:
+        case NVS_TYPE_U64: {
+            double value;
+            if (handle.GetInt(key, nvs_type, &value) != ESP_OK) {
+                return Fail(error, "Failed to get integer value");
+            }
+            cJSON_AddNumberToObject(node, "value", value);
+            break;
+        }
+        case NVS_TYPE_STR: {
+            size_t size = 0;
+            if (handle.GetString(key, nullptr, &size) != ESP_OK) {
+                return Fail(error, "Failed to get string value");
+            }
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+            std::shared_ptr<char> value((char*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM),
+                                        heap_caps_free);
+#else
+            std::shared_ptr<char> value((char*)malloc(size), free);
+#endif
+            if (handle.GetString(key, value.get(), &size) != ESP_OK) {
+                return Fail(error, "Failed to get string value");
+            }
+            cJSON_AddStringToObject(node, "value", value.get());
+            break;
+        }
+        case NVS_TYPE_BLOB: {
+            size_t size = 0;
+            if (handle.GetBlob(key, nullptr, &size) != ESP_OK) {
+                return Fail(error, "Failed to get blob value");
+            }
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+            std::shared_ptr<void> value((void*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM),
+                                        heap_caps_free);
+#else
+            std::shared_ptr<void> value((void*)malloc(size), free);
+#endif
+            if (handle.GetBlob(key, value.get(), &size) != ESP_OK) {
+                return Fail(error, "Failed to get blob value");
+            }
+
+            size_t enc64_size = 4 + size * 2;
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+            std::shared_ptr<char> enc64((char*)heap_caps_malloc(enc64_size, MALLOC_CAP_SPIRAM),
+                                        heap_caps_free);
+#else
+            std::shared_ptr<char> enc64((char*)malloc(enc64_size), free);
+#endif
+
+            size_t olen;
+            if (NvsHandle::Base64Encode(
+                    enc64.get(), enc64_size, &olen, (const char*)value.get(), size) != 0) {
+                return Fail(error, "Failed to encode blob");
+            }
+
+            cJSON_AddStringToObject(node, "value", enc64.get());
+            break;
+        }
+        default:
+            return Fail(error, "Unknown type");
+    }
+    return ESP_OK;
+}
+
+esp_err_t NvsConfig::SetKey(const char* name_space,
+                            const char* key,
+                            const cJSON* node,
+                            const char** error) {
+    cJSON* type = cJSON_GetObjectItemCaseSensitive(node, "type");
+    cJSON* value = cJSON_GetObjectItemCaseSensitive(node, "value");
+
+    if ((!cJSON_IsString(type)) || (type->valuestring == nullptr)) {
+        return Fail(error, "Failed to parse type");
+    }
+
+    nvs_type_t nvs_type;
+    if (NvsHandle::TypeOf(type->valuestring, &nvs_type) != ESP_OK) {
+        return Fail(error, "Unknown type");
+    }
+
+    NvsHandle my_handle;
+    ESP_LOGI(kTag, "Opening namespace '%s'", name_space);
+    bool staged;
+    esp_err_t err = OpenForWrite(my_handle, name_space, &staged, error);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (cJSON_IsNumber(value)) {
+        switch (nvs_type) {
+            case NVS_TYPE_U8:
+            case NVS_TYPE_I8:
+            case NVS_TYPE_U16:
+            case NVS_TYPE_I16:
+            case NVS_TYPE_U32:
+            case NVS_TYPE_I32:
+            case NVS_TYPE_U64:
+            case NVS_TYPE_I64:
+                break;
+            default:
+                return Fail(error, "Invalid type for integer value");
+        }
+        if (my_handle.SetInt(key, nvs_type, value->valueint) != ESP_OK) {
+            return Fail(error, "Failed to set integer value");
+        }
+        ESP_LOGI(kTag, "Set integer value '%d'", value->valueint);
+    } else if (cJSON_IsString(value) && (value->valuestring != nullptr)) {
+        if (nvs_type == NVS_TYPE_STR) {
+            if (my_handle.SetString(key, value->valuestring) != ESP_OK) {
+                return Fail(error, "Failed to set string value");
+            }
+            ESP_LOGI(kTag, "Set string value '%s'", value->valuestring);
+        } else if (nvs_type == NVS_TYPE_BLOB) {
+            size_t olen;
+#if defined CONFIG_SPIRAM && defined CONFIG_SPIRAM_USE_CAPS_ALLOC
+            std::shared_ptr<void> dec64(
+                (void*)heap_caps_malloc(strlen(value->valuestring), MALLOC_CAP_SPIRAM),
+                heap_caps_free);
+#else
+            std::shared_ptr<void> dec64((void*)malloc(strlen(value->valuestring)), free);
+#endif
+            if (NvsHandle::Base64Decode((char*)dec64.get(),
+                                        strlen(value->valuestring),
+                                        &olen,
+                                        value->valuestring,
+                                        strlen(value->valuestring)) != 0) {
+                return Fail(error, "Failed to decode base64 value");
+            }
+            if (my_handle.SetBlob(key, dec64.get(), olen) != ESP_OK) {
+                return Fail(error, "Failed to set string value");
+            }
+
+            ESP_LOGI(kTag, "Set blob value '%s'", value->valuestring);
+        } else {
+            return Fail(error, "Invalid type for string value");
+        }
+    } else {
+        return Fail(error, "Failed to parse value");
+    }
+
+    if (my_handle.Commit() != ESP_OK) {
+        return Fail(error, "Failed to commit NVS");
+    }
+    my_handle.Close();
+    if (!staged) {
+        Changed(name_space, key);
+    }
+    return ESP_OK;
+}
+
+esp_err_t NvsConfig::GetKey(const char* name_space,
+                            const char* key,
+                            cJSON* node,
+                            const char** error) {
+    ESP_LOGD(kTag, "Opening namespace '%s'", name_space);
+    NvsHandle my_handle;
+    esp_err_t err = my_handle.Open(name_space, NVS_READONLY);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {  // missing namespace: bundle only
+        return Fail(error, "Failed to open NVS handle");
+    }
+
+    ESP_LOGD(kTag, "Finding key '%s'", key);
+    nvs_type_t nvs_type;
+    if (my_handle.FindKey(key, &nvs_type) != ESP_OK) {
+        return Fail(error, "Failed to find key", ESP_ERR_NVS_NOT_FOUND);
+    }
+
+    return ToJson(my_handle, key, nvs_type, node, error);
+}
+
+esp_err_t NvsConfig::GetAll(cJSON* node, const char** error) {
+    std::map<std::string, std::map<std::string, int>> config;
+
+    for (auto& partition : NvsHandle::Partitions()) {
+        nvs_iterator_t it = NULL;
+        esp_err_t res = nvs_entry_find(partition.c_str(), nullptr, NVS_TYPE_ANY, &it);
+        while (res == ESP_OK) {
+            nvs_entry_info_t info;
+            nvs_entry_info(it, &info);
+            ESP_LOGD(kTag,
+                     "Partition '%s', namespace '%s', key '%s', type '%d'",
+                     partition.c_str(),
+                     info.namespace_name,
+                     info.key,
+                     info.type);
+            // Only report what NvsHandle::Open would actually read
+            const char* name_space = NvsHandle::LogicalNameSpace(info.namespace_name);
+            if (name_space != nullptr && partition == NvsHandle::PartitionOf(name_space)) {
+                config[name_space][info.key] = info.type;
+            }
+            res = nvs_entry_next(&it);
+        }
+        nvs_release_iterator(it);
+    }
+
+    // Bundle defaults under the keys NVS does not override
+    ConfigBundle* bundle = ConfigBundle::GetInstance();
+    bundle->Lock();
+    for (uint16_t i = 0; i < bundle->Count(); i++) {
+        const ConfigBundle::Entry* entry = bundle->At(i);
+        config[bundle->String(entry->name_space)].emplace(bundle->String(entry->key),
+                                                          entry->type);
+    }
+    bundle->Unlock();
+
+    NvsHandle my_handle;
+    for (auto& ns : config) {
+        my_handle.Open(ns.first.c_str(), NVS_READONLY);
+        cJSON* namespace_json = cJSON_CreateObject();
+        cJSON_AddItemToObject(node, ns.first.c_str(), namespace_json);
+        for (auto& key : ns.second) {
+            cJSON* key_json = cJSON_CreateObject();
+            cJSON_AddItemToObject(namespace_json, key.first.c_str(), key_json);
+            if (ToJson(my_handle, key.first.c_str(), (nvs_type_t)key.second, key_json, error) !=
+                ESP_OK) {
+                return ESP_FAIL;
+            }
+        }
+        my_handle.Close();
+    }
+    return ESP_OK;
+}
+
+esp_err_t NvsConfig::DeleteKey(const char* name_space, const char* key, const char** error) {
+    ESP_LOGD(kTag, "Opening namespace '%s'", name_space);
+    NvsHandle my_handle;
+    bool staged;
+    esp_err_t err = OpenForWrite(my_handle, name_space, &staged, error);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (my_handle.EraseKey(key) != ESP_OK) {
+        return Fail(error, "Failed to delete key");
+    }
+    err = my_handle.Commit();
+    my_handle.Close();
+    if (err == ESP_OK && !staged) {
+        Changed(name_space, key);
+    }
+    return err;
+}
+
+esp_err_t NvsConfig::DeleteNameSpace(const char* name_space, const char** error) {
+    ESP_LOGD(kTag, "Opening namespace '%s'", name_space);
+    NvsHandle my_handle;
+    bool staged;
+    esp_err_t err = OpenForWrite(my_handle, name_space, &staged, error);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (my_handle.EraseAll() != ESP_OK) {
+        return Fail(error, "Failed to delete namespace");
+    }
+    err = my_handle.Commit();
+    my_handle.Close();
+    if (err == ESP_OK && !staged) {
+        Changed(name_space, nullptr);
+    }
+    return err;
+}
+
+std::vector<NvsConfig::ChangeCallback> NvsConfig::change_callbacks_;
+
+void NvsConfig::Changed(const char* name_space, const char* key) {
+    for (auto& callback : change_callbacks_) {
+        callback(name_space, key);
+    }
+}
+
+static void AddHash(cJSON* node, const char* name, uint32_t hash) {
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%08" PRIx32, hash);
+    cJSON_AddStringToObject(node, name, hex);
+}
+
+static bool SameHash(const cJSON* node, uint32_t hash) {
+    if (!cJSON_IsString(node) || node->valuestring == nullptr) {
+        return false;
+    }
+    return strtoul(node->valuestring, nullptr, 16) == hash;
+}
+
+esp_err_t NvsConfig::Diff(const cJSON* request, cJSON* node, const char** error) {
+    if (!cJSON_IsObject(request)) {
+        return Fail(error, "Failed to parse hashes");
+    }
+
+    const cJSON* ns;
+    cJSON_ArrayForEach(ns, request) {
+        const cJSON* client_hash =
+            cJSON_IsObject(ns) ? cJSON_GetObjectItemCaseSensitive(ns, "hash") : ns;
+        const cJSON* client_keys = cJSON_GetObjectItemCaseSensitive(ns, "keys");
+
+        uint32_t hash;
+        std::map<std::string, uint32_t> keys;
+        if (ConfigHash::Get(ns->string, &hash, &keys) != ESP_OK) {
+            return Fail(error, "Failed to hash namespace");
+        }
+        if (SameHash(client_hash, hash)) {
+            continue;
+        }
+
+        cJSON* ns_json = cJSON_CreateObject();
+        cJSON_AddItemToObject(node, ns->string, ns_json);
+        AddHash(ns_json, "hash", hash);
+        cJSON* keys_json = cJSON_CreateObject();
+        cJSON_AddItemToObject(ns_json, "keys", keys_json);
+
+        // Without the client's key hashes, report all keys
+        for (auto& key : keys) {
+            const cJSON* client_key =
+                cJSON_IsObject(client_keys)
+                    ? cJSON_GetObjectItemCaseSensitive(client_keys, key.first.c_str())
+                    : nullptr;
+            if (!SameHash(client_key, key.second)) {
+                AddHash(keys_json, key.first.c_str(), key.second);
+            }
+        }
+        const cJSON* client_key;
+        cJSON_ArrayForEach(client_key, client_keys) {
+            if (keys.find(client_key->string) == keys.end()) {
+                cJSON_AddNullToObject(keys_json, client_key->string);
+            }
+        }
+    }
+    return ESP_OK;
+}
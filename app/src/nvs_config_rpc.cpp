@@ -0,0 +1,203 @@
+/**
+ ******************************************************************************
+ * @file        : nvs_config_rpc.cpp
+ * @brief       : Configuration RPC over MQTT
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : The configuration web services, over MQTT. Requests are
+ *                published on "<topic-base>rpc/req", or on the fleet topic
+ *                "mqtt:rpc-group-topic", as:
+ *
+ *                  {"id": "42", "method": "config/get-key",
+ *                   "params": {"namespace": "mqtt", "key": "broker"}}
+ *
+ *                and answered on "<topic-base>rpc/res" (or "reply-to", which
+ *                must be below the topic base, or the MQTT 5 response topic of
+ *                the request):
+ *
+ *                  {"id": "42", "result": {"type": "string", "value": "..."}}
+ *                  {"id": "42", "error": "Key not found"}
+ *
+ *                Secret keys are reported without their value.
+ ******************************************************************************
+ */
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+
+#include "app.hpp"
+#include "cJSON.h"
+#include "nvs_config.hpp"
+
+static const char* kTag = "config rpc";
+
+struct RpcConfig {
+    std::string group_topic;
+};
+
+static const NvsBinding<RpcConfig> kRpcConfigBinding =
+    NvsBinding<RpcConfig>("mqtt").Bind("rpc-group-topic", &RpcConfig::group_topic);
+
+// Keys whose value is never published
+static const struct {
+    const char* name_space;
+    const char* key;
+} kSecretKeys[] = {
+    {"mqtt", "password"},
+    {"nvs.net80211", "sta.pswd"},
+};
+
+static const char* GetParam(const cJSON* params, const char* name) {
+    return cJSON_GetStringValue(cJSON_GetObjectItem(params, name));
+}
+
+// Replaces the value of a secret key by "redacted": true
+static void Redact(const char* name_space, const char* key, cJSON* node) {
+    for (auto& secret : kSecretKeys) {
+        if (strcmp(name_space, secret.name_space) == 0 && strcmp(key, secret.key) == 0 &&
+            cJSON_HasObjectItem(node, "value")) {
+            cJSON_DeleteItemFromObject(node, "value");
+            cJSON_AddTrueToObject(node, "redacted");
+        }
+    }
+}
+
+void App::InitRpc() {
+    rpc_response_topic_ = mqtt_->RegisterTopic("rpc/res");
+    auto handler = [this](std::string_view topic, std::string_view payload) {
+        HandleRpc(payload);
+    };
+    mqtt_->AddSubscription("rpc/req", 1, handler, true);
+
+    RpcConfig config;
+    kRpcConfigBinding.Load(&config);
+    if (!config.group_topic.empty()) {
+        mqtt_->AddSubscription(config.group_topic.c_str(), 1, handler);
+    }
+}
+
+// Same operations and messages as the web services
+esp_err_t App::CallRpc(const char* method,
+                       const cJSON* params,
+                       cJSON* response,
+                       const char** error) {
+    const char* name_space = GetParam(params, "namespace");
+    const char* key = GetParam(params, "key");
+    bool with_key = strcmp(method, "config/set-key") == 0 ||
+                    strcmp(method, "config/get-key") == 0 ||
+                    strcmp(method, "config/delete-key") == 0;
+    if ((with_key || strcmp(method, "config/delete-namespace") == 0) && name_space == nullptr) {
+        *error = "Failed to get namespace parameter";
+        return ESP_ERR_INVALID_ARG;
+    } else if (with_key && key == nullptr) {
+        *error = "Failed to get key parameter";
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_OK;
+    if (strcmp(method, "config/set-key") == 0) {
+        err = NvsConfig::SetKey(name_space, key, cJSON_GetObjectItem(params, "value"), error);
+        if (err == ESP_OK) {
+            cJSON_AddStringToObject(response, "result", "Configuration set");
+        }
+        return err;
+    } else if (strcmp(method, "config/delete-key") == 0) {
+        err = NvsConfig::DeleteKey(name_space, key, error);
+        if (err == ESP_OK) {
+            cJSON_AddStringToObject(response, "result", "Key Deleted");
+        }
+        return err;
+    } else if (strcmp(method, "config/delete-namespace") == 0) {
+        err = NvsConfig::DeleteNameSpace(name_space, error);
+        if (err == ESP_OK) {
+            cJSON_AddStringToObject(response, "result", "Namespace Deleted");
+        }
+        return err;
+    }
+
+    cJSON* result = cJSON_AddObjectToObject(response, "result");
+    if (strcmp(method, "config/get-key") == 0) {
+        err = NvsConfig::GetKey(name_space, key, result, error);
+        Redact(name_space, key, result);
+    } else if (strcmp(method, "config/get-all") == 0) {
+        err = NvsConfig::GetAll(result, error);
+        cJSON* ns;
+        cJSON_ArrayForEach(ns, result) {
+            cJSON* item;
+            cJSON_ArrayForEach(item, ns) {
+                Redact(ns->string, item->string, item);
+            }
+        }
+    } else if (strcmp(method, "config/diff") == 0) {
+        err = NvsConfig::Diff(params, result, error);
+    } else if (strcmp(method, "info") == 0) {
+        GetInfo(result);
+    } else {
+        *error = "Unknown method";
+        err = ESP_ERR_NOT_SUPPORTED;
+    }
+    return err;
+}
+
+void App::HandleRpc(std::string_view payload) {
+    std::shared_ptr<cJSON> response(cJSON_CreateObject(), cJSON_Delete);
+    std::shared_ptr<cJSON> request(cJSON_ParseWithLength(payload.data(), payload.size()),
+                                   cJSON_Delete);
+    const char* reply_to = nullptr;
+    const char* error = nullptr;
+    if (request == nullptr) {
+        cJSON_AddNullToObject(response.get(), "id");
+        error = "Failed to parse JSON";
+    } else {
+        cJSON* id = cJSON_GetObjectItem(request.get(), "id");
+        cJSON_AddItemToObject(response.get(),
+                              "id",
+                              id != nullptr ? cJSON_Duplicate(id, true) : cJSON_CreateNull());
+        reply_to = GetParam(request.get(), "reply-to");
+        const char* method = GetParam(request.get(), "method");
+        const cJSON* params = cJSON_GetObjectItem(request.get(), "params");
+        std::string base = mqtt_->TopicBase();
+        if (reply_to != nullptr &&
+            (base.empty() || strncmp(reply_to, base.c_str(), base.size()) != 0)) {
+            // Any client could otherwise make the device publish anywhere
+            reply_to = nullptr;
+            error = "reply-to must be below the topic base";
+        } else if (method == nullptr) {
+            error = "Missing method";
+        } else if (CallRpc(method, params, response.get(), &error) != ESP_OK) {
+            cJSON_DeleteItemFromObject(response.get(), "result");
+            if (error == nullptr) {
+                error = "Failed";
+            }
+        } else {
+            ESP_LOGI(kTag, "%s done", method);
+        }
+    }
+    if (error != nullptr) {
+        ESP_LOGW(kTag, "Request failed: %s", error);
+        cJSON_AddStringToObject(response.get(), "error", error);
+    }
+
+    // Runs on an inbound worker, or on the MQTT task without workers: reply without
+    // waiting for the network
+    std::shared_ptr<char> str(cJSON_PrintUnformatted(response.get()), free);
+    MQTT::Properties properties;
+    if (reply_to != nullptr) {
+        mqtt_->PublishAsync(reply_to, str.get(), 0, 1);
+    } else if (mqtt_->MessageProperties(&properties) && !properties.response_topic.empty()) {
+        // MQTT 5 request: answer on its response topic, with its correlation data
+        MQTT::Properties reply;
+        reply.correlation_data = properties.correlation_data;
+        mqtt_->PublishAsync(properties.response_topic.c_str(), str.get(), 0, 1, 0, reply);
+    } else {
+        mqtt_->PublishAsync(rpc_response_topic_, str.get(), 0, 1);
+    }
+}
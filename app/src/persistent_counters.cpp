@@ -0,0 +1,228 @@
+/**
+ ******************************************************************************
+ * @file        : persistent_counters.cpp
+ * @brief       : Persistent Counters
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Persistent Counters
+ ******************************************************************************
+ */
+
+#include "persistent_counters.hpp"
+
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <esp_system.h>
+#include <string.h>
+
+#include <iterator>
+
+#include "nvs_config.hpp"
+
+static const char* kTag = "counters";
+
+static const int kTickPeriodSec = 10;
+static const char* kBuiltIns[] = {
+    "boots", "crashes", "uptime-s", "boot-uptime-s", "last-uptime-s"};
+
+PersistentCounters* PersistentCounters::instance_ = nullptr;
+SemaphoreHandle_t PersistentCounters::semaphore_ = xSemaphoreCreateMutex();
+RTC_NOINIT_ATTR PersistentCounters::Block PersistentCounters::block_;
+
+PersistentCounters* PersistentCounters::GetInstance() {
+    if (instance_ == nullptr) {
+        xSemaphoreTake(semaphore_, portMAX_DELAY);
+        if (instance_ == nullptr) {
+            instance_ = new PersistentCounters();
+        }
+        xSemaphoreGive(semaphore_);
+    }
+    return instance_;
+}
+
+uint32_t PersistentCounters::Crc() {
+    return esp_rom_crc32_le(0, (const uint8_t*)&block_, offsetof(Block, crc));
+}
+
+// Called with the semaphore taken. Returns nullptr if the table is full.
+PersistentCounters::Counter* PersistentCounters::Find(const char* name, bool create) {
+    for (uint32_t i = 0; i < block_.count; i++) {
+        if (strncmp(block_.counters[i].name, name, sizeof(block_.counters[i].name)) == 0) {
+            return &block_.counters[i];
+        }
+    }
+    if (!create || block_.count >= kMaxCounters || strlen(name) >= NVS_KEY_NAME_MAX_SIZE) {
+        return nullptr;
+    }
+    Counter* counter = &block_.counters[block_.count++];
+    memset(counter, 0, sizeof(*counter));
+    strlcpy(counter->name, name, sizeof(counter->name));
+    return counter;
+}
+
+// Rebuilds the RTC block from the last checkpoint
+esp_err_t PersistentCounters::Restore() {
+    memset(&block_, 0, sizeof(block_));
+    block_.magic = kMagic;
+    for (auto name : kBuiltIns) {
+        Find(name, true);
+    }
+
+    const char* partition = NvsHandle::PartitionOf(kNameSpace);
+    nvs_iterator_t it = nullptr;
+    esp_err_t res = nvs_entry_find(partition, kNameSpace, NVS_TYPE_U64, &it);
+    NvsHandle handle;
+    esp_err_t err = handle.Open(kNameSpace, NVS_READONLY);
+    while (res == ESP_OK && err == ESP_OK) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        Counter* counter = Find(info.key, true);
+        double value;
+        if (counter != nullptr && handle.GetInt(info.key, NVS_TYPE_U64, &value) == ESP_OK) {
+            counter->value = value;
+            counter->checkpointed = value;
+        }
+        res = nvs_entry_next(&it);
+    }
+    nvs_release_iterator(it);
+    Seal();
+    return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+}
+
+esp_err_t PersistentCounters::Init(int checkpoint_sec) {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    esp_err_t err = ESP_OK;
+    if (block_.magic != kMagic || block_.count < std::size(kBuiltIns) ||
+        block_.count > kMaxCounters || block_.crc != Crc()) {
+        ESP_LOGI(kTag, "Restoring counters from NVS");
+        err = Restore();
+    }
+
+    Find("boots", true)->value++;
+    switch (esp_reset_reason()) {
+        case ESP_RST_PANIC:
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+        case ESP_RST_BROWNOUT:
+            Find("crashes", true)->value++;
+            break;
+        default:
+            break;
+    }
+    Counter* boot_uptime = Find("boot-uptime-s", true);
+    Find("last-uptime-s", true)->value = boot_uptime->value;
+    boot_uptime->value = 0;
+    uptime_at_boot_ = Find("uptime-s", true)->value;
+    Seal();
+    xSemaphoreGive(semaphore_);
+
+    ticks_per_checkpoint_ = checkpoint_sec / kTickPeriodSec;
+    if (timer_ == nullptr) {
+        const esp_timer_create_args_t args = {
+            .callback = TickForwarder,
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "counters",
+            .skip_unhandled_events = true,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &timer_));
+        ESP_ERROR_CHECK(esp_timer_start_periodic(timer_, kTickPeriodSec * 1000000LL));
+        esp_register_shutdown_handler(ShutdownHandler);
+    }
+    ESP_LOGI(kTag,
+             "Boot %llu, %llu crashes",
+             (unsigned long long)Get("boots"),
+             (unsigned long long)Get("crashes"));
+    return err;
+}
+
+void PersistentCounters::Tick() {
+    uint64_t uptime = esp_timer_get_time() / 1000000;
+    Set("boot-uptime-s", uptime);
+    Set("uptime-s", uptime_at_boot_ + uptime);
+    if (ticks_per_checkpoint_ > 0 && ++ticks_ >= ticks_per_checkpoint_) {
+        ticks_ = 0;
+        Checkpoint();
+    }
+}
+
+void PersistentCounters::ShutdownHandler() {
+    if (instance_ != nullptr) {
+        instance_->Tick();
+        instance_->Checkpoint();
+    }
+}
+
+esp_err_t PersistentCounters::Add(const char* name, uint64_t delta) {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    Counter* counter = Find(name, true);
+    if (counter != nullptr) {
+        counter->value += delta;
+        Seal();
+    }
+    xSemaphoreGive(semaphore_);
+    return counter != nullptr ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t PersistentCounters::Set(const char* name, uint64_t value) {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    Counter* counter = Find(name, true);
+    if (counter != nullptr) {
+        counter->value = value;
+        Seal();
+    }
+    xSemaphoreGive(semaphore_);
+    return counter != nullptr ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+uint64_t PersistentCounters::Get(const char* name) {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    Counter* counter = Find(name, false);
+    uint64_t value = counter != nullptr ? counter->value : 0;
+    xSemaphoreGive(semaphore_);
+    return value;
+}
+
+void PersistentCounters::ForEach(std::function<void(const char* name, uint64_t value)> callback) {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    for (uint32_t i = 0; i < block_.count; i++) {
+        callback(block_.counters[i].name, block_.counters[i].value);
+    }
+    xSemaphoreGive(semaphore_);
+}
+
+// Writes the counters that changed since the last checkpoint
+esp_err_t PersistentCounters::Checkpoint() {
+    xSemaphoreTake(semaphore_, portMAX_DELAY);
+    NvsHandle handle;
+    esp_err_t err = handle.Open(kNameSpace, NVS_READWRITE);
+    int written = 0;
+    for (uint32_t i = 0; err == ESP_OK && i < block_.count; i++) {
+        Counter& counter = block_.counters[i];
+        if (counter.value == counter.checkpointed) {
+            continue;
+        }
+        err = handle.SetInt(counter.name, NVS_TYPE_U64, counter.value);
+        if (err == ESP_OK) {
+            counter.checkpointed = counter.value;
+            written++;
+        }
+    }
+    if (err == ESP_OK && written > 0) {
+        err = handle.Commit();
+    }
+    Seal();
+    xSemaphoreGive(semaphore_);
+    if (err != ESP_OK) {
+        ESP_LOGE(kTag, "Checkpoint failed: %s", esp_err_to_name(err));
+    } else {
+        ESP_LOGD(kTag, "Checkpoint: %d counters written", written);
+    }
+    return err;
+}
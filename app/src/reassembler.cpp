@@ -0,0 +1,78 @@
+/**
+ ******************************************************************************
+ * @file        : reassembler.cpp
+ * @brief       : MQTT Message Reassembler
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : MQTT Message Reassembler
+ ******************************************************************************
+ */
+
+#include "reassembler.hpp"
+
+#include <esp_log.h>
+#include <string.h>
+
+static const char* kTag = "reassembler";
+
+esp_err_t Reassembler::Configure(size_t buffers, size_t max_message_size) {
+    if (pool_.BufferSize() != 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    buffers_ = buffers;
+    max_message_size_ = max_message_size;
+    return ESP_OK;
+}
+
+bool Reassembler::Add(std::string_view topic,
+                      const char* data,
+                      int len,
+                      int offset,
+                      int total,
+                      std::shared_ptr<char>* message) {
+    if (offset == 0) {
+        buffer_ = nullptr;
+        if (pool_.BufferSize() == 0 && pool_.Init(buffers_, max_message_size_) != ESP_OK) {
+            ESP_LOGE(kTag, "Failed to allocate the reassembly buffers");
+            return false;
+        }
+        // Against the allocated size: the buffers are never reallocated
+        if (total < 0 || (size_t)total > pool_.BufferSize()) {
+            oversized_++;
+            ESP_LOGW(kTag,
+                     "Message on %.*s too large (%d bytes), dropped",
+                     (int)topic.size(),
+                     topic.data(),
+                     total);
+            return false;
+        }
+        buffer_ = pool_.Acquire();
+        if (buffer_ == nullptr) {
+            ESP_LOGW(kTag, "No buffer for %.*s", (int)topic.size(), topic.data());
+            return false;
+        }
+        topic_.assign(topic);
+        received_ = 0;
+    }
+
+    if (buffer_ == nullptr) {
+        return false;  // rest of a dropped message
+    }
+    if (offset != received_ || len < 0 || received_ + len > total) {
+        ESP_LOGW(kTag, "Unexpected fragment of %s, dropped", topic_.c_str());
+        buffer_ = nullptr;
+        return false;
+    }
+    memcpy(buffer_.get() + received_, data, len);
+    received_ += len;
+    if (received_ < total) {
+        return false;
+    }
+    *message = std::move(buffer_);
+    buffer_ = nullptr;
+    return true;
+}
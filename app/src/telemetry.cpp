@@ -0,0 +1,133 @@
+/**
+ ******************************************************************************
+ * @file        : telemetry.cpp
+ * @brief       : Batched Telemetry Publisher
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Batched Telemetry Publisher
+ ******************************************************************************
+ */
+
+#include "telemetry.hpp"
+
+#include <esp_log.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include <memory>
+#include <string>
+
+#include "cJSON.h"
+
+static const char* kTag = "telemetry";
+
+Telemetry* Telemetry::instance_ = nullptr;
+SemaphoreHandle_t Telemetry::semaphore_ = xSemaphoreCreateMutex();
+
+Telemetry* Telemetry::GetInstance() {
+    if (instance_ == nullptr) {
+        xSemaphoreTake(semaphore_, portMAX_DELAY);
+        if (instance_ == nullptr) {
+            instance_ = new Telemetry();
+        }
+        xSemaphoreGive(semaphore_);
+    }
+    return instance_;
+}
+
+Telemetry::Telemetry() { mutex_ = xSemaphoreCreateMutex(); }
+
+int Telemetry::AddChannel(const char* name, int decimals) {
+    if (timer_ != nullptr || decimals < 0 || decimals > 9) {
+        return -1;
+    }
+    channels_.push_back({name, decimals, pow(10, decimals)});
+    return channels_.size() - 1;
+}
+
+esp_err_t Telemetry::Start(const char* topic,
+                           size_t max_batch_bytes,
+                           int flush_interval_ms,
+                           int qos) {
+    if (timer_ != nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    MQTT* mqtt = MQTT::GetInstance();
+    topic_ = mqtt->RegisterTopic(topic);
+    schema_topic_ = mqtt->RegisterTopic((std::string(topic) + "/schema").c_str());
+    max_batch_bytes_ = max_batch_bytes;
+    qos_ = qos;
+
+    const esp_timer_create_args_t args = {
+        .callback = FlushTimerForwarder,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "telemetry",
+        .skip_unhandled_events = true,
+    };
+    esp_err_t err = esp_timer_create(&args, &timer_);
+    if (err == ESP_OK) {
+        err = esp_timer_start_periodic(timer_, flush_interval_ms * 1000LL);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    return PublishSchema();
+}
+
+esp_err_t Telemetry::PublishSchema() {
+    std::shared_ptr<cJSON> root(cJSON_CreateObject(), cJSON_Delete);
+    cJSON_AddNumberToObject(root.get(), "version", TelemetryBatch::kVersion);
+    cJSON* channels = cJSON_AddArrayToObject(root.get(), "channels");
+    for (auto& c : channels_) {
+        cJSON* channel = cJSON_CreateObject();
+        cJSON_AddStringToObject(channel, "name", c.name.c_str());
+        cJSON_AddNumberToObject(channel, "decimals", c.decimals);
+        cJSON_AddItemToArray(channels, channel);
+    }
+    std::shared_ptr<char> schema(cJSON_PrintUnformatted(root.get()), free);
+    if (schema == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    return MQTT::GetInstance()->PublishAsync(schema_topic_, schema.get(), 0, 1, 1);
+}
+
+esp_err_t Telemetry::Record(int channel, double value) {
+    if (channel < 0 || channel >= (int)channels_.size()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    int64_t timestamp = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    batch_.Add(channel, timestamp, llround(value * channels_[channel].scale));
+    samples_++;
+    bool full = batch_.Size() >= max_batch_bytes_;
+    xSemaphoreGive(mutex_);
+    return full ? Flush() : ESP_OK;
+}
+
+// Publishes without waiting for the network (MQTT::PublishAsync copies the batch)
+esp_err_t Telemetry::Flush() {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    if (batch_.Empty()) {
+        xSemaphoreGive(mutex_);
+        return ESP_OK;
+    }
+    const std::vector<uint8_t>& data = batch_.Data();
+    esp_err_t err = MQTT::GetInstance()->PublishAsync(
+        topic_, (const char*)data.data(), data.size(), qos_, 0);
+    ESP_LOGD(kTag, "Batch of %d samples, %d bytes", (int)batch_.Samples(), (int)data.size());
+    batch_.Reset();
+    batches_++;
+    xSemaphoreGive(mutex_);
+    if (err != ESP_OK) {
+        ESP_LOGW(kTag, "Failed to publish a batch: %s", esp_err_to_name(err));
+    }
+    return err;
+}
@@ -0,0 +1,47 @@
+/**
+ ******************************************************************************
+ * @file        : telemetry_batch.cpp
+ * @brief       : Compact Telemetry Batch Encoding
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : Compact Telemetry Batch Encoding
+ ******************************************************************************
+ */
+
+#include "telemetry_batch.hpp"
+
+void TelemetryBatch::PutVarint(uint64_t value) {
+    while (value >= 0x80) {
+        data_.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    data_.push_back((uint8_t)value);
+}
+
+void TelemetryBatch::Reset() {
+    data_.clear();
+    last_values_.assign(last_values_.size(), 0);
+    samples_ = 0;
+}
+
+void TelemetryBatch::Add(uint32_t channel, int64_t timestamp_ms, int64_t value) {
+    if (samples_ == 0) {
+        data_.push_back(kMagic);
+        data_.push_back(kVersion);
+        PutVarint(timestamp_ms);
+        last_timestamp_ = timestamp_ms;
+    }
+    if (channel >= last_values_.size()) {
+        last_values_.resize(channel + 1, 0);
+    }
+    PutVarint(channel);
+    PutSignedVarint(timestamp_ms - last_timestamp_);
+    PutSignedVarint(value - last_values_[channel]);
+    last_timestamp_ = timestamp_ms;
+    last_values_[channel] = value;
+    samples_++;
+}
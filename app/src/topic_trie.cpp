@@ -0,0 +1,114 @@
+/**
+ ******************************************************************************
+ * @file        : topic_trie.cpp
+ * @brief       : MQTT Topic Filter Trie
+ * @author      : Jacques Supcik <jacques@supcik.net>
+ * @date        : 17 October 2026
+ ******************************************************************************
+ * @copyright   : Copyright (c) 2026 HouseTrap Group
+ * @attention   : SPDX-License-Identifier: MIT
+ ******************************************************************************
+ * @details     : MQTT Topic Filter Trie
+ ******************************************************************************
+ */
+
+#include "topic_trie.hpp"
+
+// Splits the first level off `rest`; `last` is set when no level follows
+static std::string_view NextLevel(std::string_view* rest, bool* last) {
+    size_t slash = rest->find('/');
+    std::string_view level = rest->substr(0, slash);
+    *last = slash == std::string_view::npos;
+    *rest = *last ? std::string_view() : rest->substr(slash + 1);
+    return level;
+}
+
+void TopicTrie::Add(std::string_view filter, Handler handler) {
+    Node* node = &root_;
+    bool last = false;
+    while (!last) {
+        std::string_view level = NextLevel(&filter, &last);
+        if (level == "#") {
+            node->hash_handlers.push_back(handler);
+            return;  // '#' must be the last level
+        } else if (level == "+") {
+            if (node->plus == nullptr) {
+                node->plus = std::make_unique<Node>();
+            }
+            node = node->plus.get();
+        } else {
+            auto child = node->children.find(level);
+            if (child == node->children.end()) {
+                child = node->children.emplace(std::string(level), std::make_unique<Node>()).first;
+            }
+            node = child->second.get();
+        }
+    }
+    node->handlers.push_back(handler);
+}
+
+static int Call(const std::vector<TopicTrie::Handler>& handlers,
+                std::string_view topic,
+                std::string_view payload) {
+    for (auto& handler : handlers) {
+        handler(topic, payload);
+    }
+    return handlers.size();
+}
+
+int TopicTrie::Visit(const Node* node,
+                     std::string_view topic,
+                     std::string_view rest,
+                     bool first,
+                     std::string_view payload) {
+    bool wildcards = !(first && !rest.empty() && rest[0] == '$');
+    // "a/#" matches "a" and everything below it
+    int count = wildcards ? Call(node->hash_handlers, topic, payload) : 0;
+
+    bool last = false;
+    std::string_view level = NextLevel(&rest, &last);
+    const Node* next[2] = {nullptr, wildcards ? node->plus.get() : nullptr};
+    auto child = node->children.find(level);
+    if (child != node->children.end()) {
+        next[0] = child->second.get();
+    }
+    for (const Node* n : next) {
+        if (n == nullptr) {
+            continue;
+        } else if (last) {
+            count += Call(n->handlers, topic, payload);
+            count += Call(n->hash_handlers, topic, payload);
+        } else {
+            count += Visit(n, topic, rest, false, payload);
+        }
+    }
+    return count;
+}
+
+int TopicTrie::Dispatch(std::string_view topic, std::string_view payload, size_t prefix) const {
+    return Visit(&root_, topic, topic.substr(prefix), true, payload);
+}
+
+bool TopicTrie::Matches(std::string_view filter, std::string_view topic) {
+    // As in Visit, wildcards at the first level do not match "$" topics
+    if (!topic.empty() && topic[0] == '$' && !filter.empty() &&
+        (filter[0] == '+' || filter[0] == '#')) {
+        return false;
+    }
+    bool filter_last = false;
+    bool topic_last = false;
+    while (!filter_last && !topic_last) {
+        std::string_view level = NextLevel(&filter, &filter_last);
+        if (level == "#") {
+            return true;
+        }
+        std::string_view name = NextLevel(&topic, &topic_last);
+        if (level != "+" && level != name) {
+            return false;
+        }
+    }
+    if (topic_last && !filter_last) {
+        return filter == "#";  // "a/#" matches "a"
+    }
+    return filter_last && topic_last;
+}
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+# Copyright (c) 2026 HouseTrap Group
+"""Compute configuration hashes (see include/config_hash.hpp).
+
+The input is the desired configuration, in the format of GET /config/get-all,
+bundle defaults included: the device hashes the same keys.
+The output is the body of a POST /config/diff request:
+
+    {"mqtt": {"hash": "1a2b3c4d", "keys": {"broker": "5e6f7a8b"}}}
+
+The reply lists the namespaces and keys whose value on the device differs.
+"""
+
+import argparse
+import json
+import zlib
+
+from mkconfigbundle import encode
+
+
+def key_hash(key, node):
+    nvs_type, value = encode(node["type"], node["value"])
+    crc = zlib.crc32(key.encode() + b"\0")
+    crc = zlib.crc32(bytes([nvs_type]), crc)
+    return zlib.crc32(value, crc)
+
+
+def hashes(config):
+    request = {}
+    for name_space, keys in config.items():
+        ns_hash = 0
+        key_hashes = {}
+        for key, node in keys.items():
+            h = key_hash(key, node)
+            key_hashes[key] = f"{h:08x}"
+            ns_hash ^= h
+        request[name_space] = {"hash": f"{ns_hash:08x}", "keys": key_hashes}
+    return request
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="JSON configuration")
+    parser.add_argument("--no-keys", action="store_true", help="only send namespace hashes")
+    args = parser.parse_args()
+
+    with open(args.input) as f:
+        request = hashes(json.load(f))
+    if args.no_keys:
+        request = {name_space: node["hash"] for name_space, node in request.items()}
+    print(json.dumps(request, indent=2))
+
+
+if __name__ == "__main__":
+    main()
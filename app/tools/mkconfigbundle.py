@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+# Copyright (c) 2026 HouseTrap Group
+"""Build a read-only configuration bundle (see include/config_bundle.hpp).
+
+The input is a JSON document in the same format as the reply of
+GET /config/get-all:
+
+    {"mqtt": {"broker": {"type": "string", "value": "mqtt://10.0.0.1"}}}
+
+Blob values are base64 encoded, as for /config/set-key.
+"""
+
+import argparse
+import base64
+import json
+import struct
+import sys
+import zlib
+
+MAGIC = 0x42435448  # "HTCB"
+VERSION = 1
+HEADER = struct.Struct("<IHHII")
+ENTRY = struct.Struct("<IIIHBB")
+
+INTEGERS = {
+    "uint8": (0x01, "<B"),
+    "int8": (0x11, "<b"),
+    "uint16": (0x02, "<H"),
+    "int16": (0x12, "<h"),
+    "uint32": (0x04, "<I"),
+    "int32": (0x14, "<i"),
+    "uint64": (0x08, "<Q"),
+    "int64": (0x18, "<q"),
+}
+NVS_TYPE_STR = 0x21
+NVS_TYPE_BLOB = 0x42
+
+
+def encode(type_name, value):
+    if type_name in INTEGERS:
+        nvs_type, fmt = INTEGERS[type_name]
+        return nvs_type, struct.pack(fmt, int(value))
+    if type_name == "string":
+        return NVS_TYPE_STR, str(value).encode() + b"\0"
+    if type_name == "blob":
+        return NVS_TYPE_BLOB, base64.b64decode(value)
+    raise ValueError(f"unknown type '{type_name}'")
+
+
+def build(config):
+    items = []
+    for name_space, keys in config.items():
+        if len(name_space) > 15:
+            raise ValueError(f"namespace '{name_space}' is longer than 15 characters")
+        for key, node in keys.items():
+            if len(key) > 15:
+                raise ValueError(f"key '{key}' is longer than 15 characters")
+            nvs_type, value = encode(node["type"], node["value"])
+            if len(value) > 0xFFFF:
+                raise ValueError(f"value of '{name_space}:{key}' is too large")
+            items.append((name_space.encode(), key.encode(), nvs_type, value))
+    # The device looks entries up with a binary search on (namespace, key)
+    items.sort(key=lambda item: (item[0], item[1]))
+
+    data = bytearray()
+    strings = {}
+    base = HEADER.size + ENTRY.size * len(items)
+
+    def intern(raw):
+        if raw not in strings:
+            strings[raw] = base + len(data)
+            data.extend(raw + b"\0")
+        return strings[raw]
+
+    entries = bytearray()
+    for name_space, key, nvs_type, value in items:
+        ns_offset = intern(name_space)
+        key_offset = intern(key)
+        while len(data) % 4:
+            data.append(0)
+        value_offset = base + len(data)
+        data.extend(value)
+        entries.extend(ENTRY.pack(ns_offset, key_offset, value_offset, len(value), nvs_type, 0))
+
+    body = bytes(entries + data)
+    header = HEADER.pack(MAGIC, VERSION, len(items), HEADER.size + len(body), zlib.crc32(body))
+    return header + body
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="JSON configuration")
+    parser.add_argument("output", help="binary bundle")
+    parser.add_argument("--partition-size", type=lambda x: int(x, 0), default=0x10000)
+    args = parser.parse_args()
+
+    with open(args.input) as f:
+        bundle = build(json.load(f))
+    if len(bundle) > args.partition_size:
+        sys.exit(f"bundle ({len(bundle)} bytes) does not fit in the partition")
+    with open(args.output, "wb") as f:
+        f.write(bundle)
+    print(f"{args.output}: {len(bundle)} bytes")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+# Copyright (c) 2026 HouseTrap Group
+"""Decode telemetry batches (see include/telemetry_batch.hpp).
+
+The schema is the retained JSON document published on <topic>/schema:
+
+    mosquitto_sub -C 1 -t fh/es2/telemetry/schema > schema.json
+    mosquitto_sub -C 1 -t fh/es2/telemetry > batch.bin
+    tools/telemetry.py schema.json batch.bin
+
+Prints one line per sample: timestamp (ms), channel name, value.
+"""
+
+import argparse
+import json
+
+
+def varint(data, pos):
+    value = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if b < 0x80:
+            return value, pos
+
+
+def svarint(data, pos):
+    value, pos = varint(data, pos)
+    return (value >> 1) ^ -(value & 1), pos
+
+
+def decode(schema, data):
+    if len(data) < 2 or data[0] != ord("T") or data[1] != schema["version"]:
+        raise ValueError("not a telemetry batch of this version")
+    channels = schema["channels"]
+    timestamp, pos = varint(data, 2)
+    values = {}
+    while pos < len(data):
+        channel, pos = varint(data, pos)
+        dt, pos = svarint(data, pos)
+        dv, pos = svarint(data, pos)
+        timestamp += dt
+        values[channel] = values.get(channel, 0) + dv
+        decimals = channels[channel]["decimals"]
+        value = values[channel] / 10**decimals if decimals > 0 else values[channel]
+        yield timestamp, channels[channel]["name"], value
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("schema", type=argparse.FileType("r"), help="schema document")
+    parser.add_argument("batch", type=argparse.FileType("rb"), help="binary batch")
+    args = parser.parse_args()
+
+    schema = json.load(args.schema)
+    for timestamp, name, value in decode(schema, args.batch.read()):
+        print(f"{timestamp} {name} {value}")
+
+
+if __name__ == "__main__":
+    main()